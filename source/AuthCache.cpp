@@ -0,0 +1,220 @@
+/* Authorization cache
+ */
+
+#include "AuthCache.h"
+#include "mbed-trace/mbed_trace.h"
+
+#define TRACE_GROUP "AUTH"
+
+using namespace std::chrono;
+
+namespace {
+struct SavedEntry {
+    uint32_t seconds_left; // the clock restarts at boot, so the time left is saved
+    uint16_t fingerprint;
+    uint8_t allowed;
+};
+
+const char CACHE_KEY[] = "authcache";
+
+/* changes that come within this delay of the first one share its flash write */
+const milliseconds SAVE_DELAY(1000);
+}
+
+static_assert(MBED_CONF_APP_AUTH_CACHE_SIZE <= 255, "the saved cache counts its entries in a uint8_t");
+
+struct AuthCache::Saved {
+    uint32_t version;
+    uint8_t has_version;
+    uint8_t count;
+    SavedEntry entries[MBED_CONF_APP_AUTH_CACHE_SIZE];
+};
+
+AuthCache::AuthCache(Kernel::Clock::duration allow_ttl, Kernel::Clock::duration deny_ttl, TDBStore *store,
+                     EventQueue *queue) :
+    _allow_ttl(allow_ttl),
+    _deny_ttl(deny_ttl),
+    _store(store),
+    _queue(queue)
+{
+}
+
+void AuthCache::init()
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if (!_store) {
+        return;
+    }
+    load();
+    _ready = true;
+}
+
+AuthCache::Result AuthCache::lookup(uint16_t fingerprint)
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    Entry *entry = find(fingerprint);
+    if (!entry) {
+        return MISS;
+    }
+    if (entry->expiry <= Kernel::Clock::now()) {
+        entry->valid = false;
+        return MISS;
+    }
+    return entry->allowed ? ALLOWED : DENIED;
+}
+
+void AuthCache::store(uint16_t fingerprint, bool allowed)
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    Entry *entry = find(fingerprint);
+    if (!entry) {
+        /* a free slot, or else the one closest to expiring */
+        entry = &_entries[0];
+        for (Entry &candidate : _entries) {
+            if (!candidate.valid) {
+                entry = &candidate;
+                break;
+            }
+            if (candidate.expiry < entry->expiry) {
+                entry = &candidate;
+            }
+        }
+    }
+
+    entry->fingerprint = fingerprint;
+    entry->allowed = allowed;
+    entry->expiry = Kernel::Clock::now() + (allowed ? _allow_ttl : _deny_ttl);
+    entry->valid = true;
+    save();
+}
+
+void AuthCache::invalidate(uint16_t fingerprint)
+{
+    invalidate(fingerprint, 1);
+}
+
+void AuthCache::invalidate(uint16_t first, uint16_t count)
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    bool changed = false;
+    for (Entry &entry : _entries) {
+        if (entry.valid && entry.fingerprint >= first && entry.fingerprint - first < count) {
+            entry.valid = false;
+            changed = true;
+        }
+    }
+    if (changed) {
+        save();
+    }
+}
+
+void AuthCache::set_version(uint32_t version)
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    if (_has_version && version == _version) {
+        return;
+    }
+    if (_has_version) {
+        tr_info("Access rules changed (version %lu), authorization cache cleared", (unsigned long)version);
+        clear();
+    }
+    _version = version;
+    _has_version = true;
+    save();
+}
+
+AuthCache::Entry *AuthCache::find(uint16_t fingerprint)
+{
+    for (Entry &entry : _entries) {
+        if (entry.valid && entry.fingerprint == fingerprint) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void AuthCache::clear()
+{
+    for (Entry &entry : _entries) {
+        entry.valid = false;
+    }
+}
+
+void AuthCache::load()
+{
+    Saved saved = {};
+    size_t actual = 0;
+    if (_store->get(CACHE_KEY, &saved, sizeof(saved), &actual) != MBED_SUCCESS || actual != sizeof(saved)) {
+        return;
+    }
+
+    _version = saved.version;
+    _has_version = saved.has_version;
+
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+    for (size_t i = 0; i < saved.count && i < MAX_ENTRIES; i++) {
+        _entries[i].fingerprint = saved.entries[i].fingerprint;
+        _entries[i].allowed = saved.entries[i].allowed;
+        _entries[i].expiry = now + seconds(saved.entries[i].seconds_left);
+        _entries[i].valid = true;
+    }
+    tr_info("Authorization cache: %d answer(s) loaded", (int)saved.count);
+}
+
+void AuthCache::save()
+{
+    if (!_ready || _save_pending) {
+        return;
+    }
+    if (_queue) {
+        _save_pending = _queue->call_in(SAVE_DELAY, this, &AuthCache::flush) != 0;
+        if (_save_pending) {
+            return;
+        }
+    }
+    Saved saved = {};
+    snapshot(saved);
+    write(saved);
+}
+
+/* the table is copied under the lock and written without it, lookups don't wait for
+ * the flash */
+void AuthCache::flush()
+{
+    Saved saved = {};
+    {
+        ScopedLock<Mutex> lock(_mutex);
+        _save_pending = false;
+        snapshot(saved);
+    }
+    write(saved);
+}
+
+void AuthCache::snapshot(Saved &saved)
+{
+    saved.version = _version;
+    saved.has_version = _has_version;
+
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+    for (const Entry &entry : _entries) {
+        if (!entry.valid || entry.expiry <= now) {
+            continue;
+        }
+        SavedEntry &out = saved.entries[saved.count++];
+        out.fingerprint = entry.fingerprint;
+        out.allowed = entry.allowed;
+        out.seconds_left = duration_cast<seconds>(entry.expiry - now).count();
+    }
+}
+
+void AuthCache::write(const Saved &saved)
+{
+    int result = _store->set(CACHE_KEY, &saved, sizeof(saved), 0);
+    if (result != MBED_SUCCESS) {
+        tr_error("Error! authorization cache write returned: %d", result);
+    }
+}
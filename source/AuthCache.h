@@ -0,0 +1,85 @@
+/* Authorization cache
+ *
+ * Remembers the server's answer to a sign-in for each fingerprint slot, so that a
+ * known finger is let in (or turned away) without waiting on the network. Answers
+ * expire, and all of them are dropped when the server announces a new version of
+ * its access rules. The table can be kept in the TDBStore to survive a reboot, the
+ * writes are then left to a low priority queue and grouped.
+ */
+
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include "mbed.h"
+#include "TDBStore.h"
+
+class AuthCache {
+    static constexpr size_t MAX_ENTRIES = MBED_CONF_APP_AUTH_CACHE_SIZE;
+
+public:
+    enum Result {
+        MISS,
+        ALLOWED,
+        DENIED
+    };
+
+    /* answers are kept allow_ttl when the finger was allowed, deny_ttl when it was
+     * refused. With a store, the table is saved there after a change: on queue, a
+     * moment later so that the caller doesn't wait for the flash and the changes made
+     * meanwhile share the write, or right away without a queue */
+    AuthCache(Kernel::Clock::duration allow_ttl, Kernel::Clock::duration deny_ttl, TDBStore *store = nullptr,
+              EventQueue *queue = nullptr);
+
+    /* load the saved table, store must be initialized */
+    void init();
+
+    Result lookup(uint16_t fingerprint);
+
+    /* record the server's answer for fingerprint */
+    void store(uint16_t fingerprint, bool allowed);
+
+    /* forget the answer for fingerprint, the next sign-in asks the server */
+    void invalidate(uint16_t fingerprint);
+
+    /* forget the answers for count fingerprints from first on, with one save */
+    void invalidate(uint16_t first, uint16_t count);
+
+    /* version of the access rules given by the server, a new one empties the cache */
+    void set_version(uint32_t version);
+
+private:
+    struct Entry {
+        Kernel::Clock::time_point expiry;
+        uint16_t fingerprint;
+        bool allowed;
+        bool valid;
+    };
+
+    /* the record kept in the store */
+    struct Saved;
+
+    Entry *find(uint16_t fingerprint);
+    void clear();
+    void load();
+
+    /* the table changed, called with _mutex held */
+    void save();
+
+    /* the delayed save, on _queue */
+    void flush();
+    void snapshot(Saved &saved);
+    void write(const Saved &saved);
+
+    Kernel::Clock::duration _allow_ttl;
+    Kernel::Clock::duration _deny_ttl;
+    TDBStore *_store;
+    EventQueue *_queue;
+    Mutex _mutex;
+    bool _ready = false;
+    bool _save_pending = false;
+    bool _has_version = false;
+    uint32_t _version = 0;
+    Entry _entries[MAX_ENTRIES] = {};
+};
+
+#endif
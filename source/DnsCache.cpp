@@ -0,0 +1,138 @@
+/* DNS resolution cache
+ */
+
+#include "DnsCache.h"
+#include "mbed.h"
+#include "mbed-trace/mbed_trace.h"
+
+#define TRACE_GROUP "DNS"
+
+DnsCache::DnsCache(NetworkInterface *net, EventQueue *queue, Kernel::Clock::duration ttl) :
+    _net(net), _queue(queue), _ttl(ttl)
+{
+}
+
+nsapi_error_t DnsCache::resolve(const char *hostname, SocketAddress *address)
+{
+    {
+        ScopedLock<Mutex> lock(_mutex);
+        Entry *entry = find(hostname);
+        if (entry) {
+            *address = entry->address;
+            if (Kernel::Clock::now() >= entry->expiry) {
+                refresh(hostname);
+            }
+            return NSAPI_ERROR_OK;
+        }
+    }
+
+    /* cold cache, this is the only case where the caller waits for the module */
+    tr_debug("Resolve hostname %s", hostname);
+    nsapi_error_t result = _net->gethostbyname(hostname, address);
+    if (result != NSAPI_ERROR_OK) {
+        tr_error("Error! gethostbyname(%s) returned: %d", hostname, result);
+        return result;
+    }
+    tr_debug("%s address is %s", hostname, (address->get_ip_address() ? address->get_ip_address() : "None"));
+
+    store(hostname, *address);
+    return NSAPI_ERROR_OK;
+}
+
+void DnsCache::refresh(const char *hostname)
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if (_refreshing[0] != '\0' || strlen(hostname) > MAX_HOSTNAME_LENGTH) {
+        return;
+    }
+    strcpy(_refreshing, hostname);
+
+    nsapi_value_or_error_t result = _net->gethostbyname_async(_refreshing, callback(this, &DnsCache::async_resolved));
+    if (result < 0) {
+        /* the driver may not implement asynchronous lookups, resolve on the queue thread instead */
+        if (!_queue->call(this, &DnsCache::blocking_refresh)) {
+            _refreshing[0] = '\0';
+        }
+    }
+}
+
+void DnsCache::invalidate(const char *hostname)
+{
+    ScopedLock<Mutex> lock(_mutex);
+    Entry *entry = find(hostname);
+    if (entry) {
+        entry->valid = false;
+    }
+}
+
+DnsCache::Entry *DnsCache::find(const char *hostname)
+{
+    for (Entry &entry : _entries) {
+        if (entry.valid && strcmp(entry.hostname, hostname) == 0) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+DnsCache::Entry *DnsCache::insert(const char *hostname)
+{
+    Entry *slot = &_entries[0];
+    for (Entry &entry : _entries) {
+        if (!entry.valid || strcmp(entry.hostname, hostname) == 0) {
+            slot = &entry;
+            break;
+        }
+        /* otherwise reuse the entry that expires first */
+        if (entry.expiry < slot->expiry) {
+            slot = &entry;
+        }
+    }
+    strcpy(slot->hostname, hostname);
+    return slot;
+}
+
+void DnsCache::store(const char *hostname, const SocketAddress &address)
+{
+    if (strlen(hostname) > MAX_HOSTNAME_LENGTH) {
+        return;
+    }
+
+    ScopedLock<Mutex> lock(_mutex);
+    Entry *entry = insert(hostname);
+    entry->address = address;
+    entry->expiry = Kernel::Clock::now() + _ttl;
+    entry->valid = true;
+}
+
+/* called from the network stack once the lookup started by refresh() completes */
+void DnsCache::async_resolved(nsapi_value_or_error_t result, SocketAddress *address)
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if (result >= 0 && address) {
+        store(_refreshing, *address);
+    } else {
+        tr_error("Error! DNS refresh of %s returned: %d", _refreshing, result);
+    }
+    _refreshing[0] = '\0';
+}
+
+void DnsCache::blocking_refresh()
+{
+    char hostname[MAX_HOSTNAME_LENGTH + 1];
+    {
+        ScopedLock<Mutex> lock(_mutex);
+        strcpy(hostname, _refreshing);
+    }
+
+    SocketAddress address;
+    nsapi_error_t result = _net->gethostbyname(hostname, &address);
+    if (result == NSAPI_ERROR_OK) {
+        store(hostname, address);
+    } else {
+        tr_error("Error! DNS refresh of %s returned: %d", hostname, result);
+    }
+
+    ScopedLock<Mutex> lock(_mutex);
+    _refreshing[0] = '\0';
+}
@@ -0,0 +1,55 @@
+/* DNS resolution cache
+ *
+ * Keeps the address of the few hostnames the device talks to so that a request
+ * does not go through the Wi-Fi module for a lookup every time. Entries past their
+ * TTL are still served while a refresh runs in the background: only a cold cache
+ * makes the caller wait on DNS.
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include "mbed.h"
+
+class DnsCache {
+    static constexpr size_t MAX_ENTRIES = 2;
+    static constexpr size_t MAX_HOSTNAME_LENGTH = 64;
+
+public:
+    /* ttl is how long a resolved address is considered fresh, refreshes that can't be
+     * done with gethostbyname_async() run on queue */
+    DnsCache(NetworkInterface *net, EventQueue *queue, Kernel::Clock::duration ttl);
+
+    /* fill address for hostname, from the cache when possible */
+    nsapi_error_t resolve(const char *hostname, SocketAddress *address);
+
+    /* resolve hostname again in the background, keeping the current address meanwhile */
+    void refresh(const char *hostname);
+
+    /* forget hostname, e.g. when connecting to the cached address failed */
+    void invalidate(const char *hostname);
+
+private:
+    struct Entry {
+        char hostname[MAX_HOSTNAME_LENGTH + 1];
+        SocketAddress address;
+        Kernel::Clock::time_point expiry;
+        bool valid;
+    };
+
+    Entry *find(const char *hostname);
+    Entry *insert(const char *hostname);
+    void store(const char *hostname, const SocketAddress &address);
+    void async_resolved(nsapi_value_or_error_t result, SocketAddress *address);
+    void blocking_refresh();
+
+    NetworkInterface *_net;
+    EventQueue *_queue;
+    Kernel::Clock::duration _ttl;
+    Mutex _mutex;
+    Entry _entries[MAX_ENTRIES] = {};
+    /* only one refresh is in flight at a time, this is the hostname it is for */
+    char _refreshing[MAX_HOSTNAME_LENGTH + 1] = {};
+};
+
+#endif
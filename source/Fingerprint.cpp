@@ -21,20 +21,79 @@
  */
 
 #include "Fingerprint.h"  
+#include "Metrics.h"
 #include "mbed.h"
-#include <vector>
+#include <algorithm>
+
+static_assert(FINGERPRINT_RX_BUFFER_SIZE >=
+                  2 * (FINGERPRINT_RX_RECORD_HEADER + FINGERPRINT_MAX_PAYLOAD),
+              "the reception buffer must hold two full data packets");
+
+/*!
+ * @brief Reply timeout and retries of each command. The timeouts cover the
+ * sensor's worst case (a full library search, a flash write), commands that
+ * start a data transfer or change the link are not sent twice
+ */
+struct Fingerprint_Profile {
+  uint8_t command;  ///< Instruction code
+  uint16_t timeout; ///< Milliseconds to wait for the ack
+  uint8_t retries;  ///< Sends after the first one on a timeout or bad reply
+  int8_t adaptive;  ///< Slot of its measured latencies, -1 for a fixed timeout
+};
+
+static const Fingerprint_Profile PROFILES[] = {
+    {FINGERPRINT_GETIMAGE, 1000, 2, 0},
+    {FINGERPRINT_IMAGE2TZ, 1000, 2, 1},
+    // a search takes as long as the part of the library it covers
+    {FINGERPRINT_SEARCH, 2000, 2, -1},
+    {FINGERPRINT_HISPEEDSEARCH, 2000, 2, -1},
+    {FINGERPRINT_REGMODEL, 1000, 2, -1},
+    {FINGERPRINT_STORE, 1000, 2, -1},
+    {FINGERPRINT_LOAD, 1000, 2, -1},
+    {FINGERPRINT_DELETE, 1000, 2, -1},
+    {FINGERPRINT_EMPTY, 3000, 1, -1},
+    // only the command check ack, the steps have their own timeout
+    {FINGERPRINT_AUTOIDENTIFY, 1000, 1, -1},
+    {FINGERPRINT_AUTOENROLL, 1000, 1, -1},
+    {FINGERPRINT_UPLOAD, 1000, 0, -1},
+    {FINGERPRINT_DOWNLOAD, 1000, 0, -1},
+    {FINGERPRINT_WRITE_REG, 500, 0, -1},
+    {FINGERPRINT_SETPASSWORD, 500, 0, -1},
+    {FINGERPRINT_VERIFYPASSWORD, 200, 0, -1}, // autoBaud() tries it at every rate
+    {FINGERPRINT_READSYSPARAM, 200, 2, -1},
+    {FINGERPRINT_TEMPLATECOUNT, 200, 2, -1},
+    {FINGERPRINT_READINDEXTABLE, 200, 2, -1},
+    {FINGERPRINT_AURALEDCONFIG, 200, 2, -1},
+    {FINGERPRINT_LEDON, 200, 2, -1},
+    {FINGERPRINT_LEDOFF, 200, 2, -1},
+};
+
+static const Fingerprint_Profile DEFAULT_PROFILE = {0, DEFAULTTIMEOUT, 0, -1};
 
 
 /*!
  * @brief Gets the command packet
  */
 #define GET_CMD_PACKET(...)                                                    \
+ScopedLock<Mutex> lock(cmdMutex);                                              \
 uint8_t data[] = {__VA_ARGS__};                                                \
- Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data),data);      \
-  writeStructuredPacket(packet);                                               \
-  if (getStructuredPacket(&packet) != FINGERPRINT_OK)                          \
-    return FINGERPRINT_PACKETRECIEVEERR;                                       \
-  if (packet.type != FINGERPRINT_ACKPACKET)                                   \
+uint8_t frame[sizeof(data) + FINGERPRINT_FRAME_OVERHEAD];                      \
+uint16_t frameSize = encodeFingerprintFrame(frame, 0xFFFFFFFF,                 \
+                       FINGERPRINT_COMMANDPACKET, data, sizeof(data));         \
+ Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, 0, nullptr);             \
+  if (transact(frame, frameSize, &packet) != FINGERPRINT_OK)                   \
+    return FINGERPRINT_PACKETRECIEVEERR;
+
+/*!
+ * @brief Gets the command packet, for commands with constant parameters: the
+ * frame is built at compile time and sent as is
+ */
+#define GET_FIXED_CMD_PACKET(...)                                              \
+  ScopedLock<Mutex> lock(cmdMutex);                                            \
+  static constexpr uint8_t data[] = {__VA_ARGS__};                             \
+  static constexpr Fingerprint_Frame<sizeof(data)> frame(data);                \
+  Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, 0, nullptr);            \
+  if (transact(frame.bytes, sizeof(frame.bytes), &packet) != FINGERPRINT_OK)   \
     return FINGERPRINT_PACKETRECIEVEERR;
 
 /*!
@@ -44,6 +103,13 @@ uint8_t data[] = {__VA_ARGS__};                                                \
   GET_CMD_PACKET(__VA_ARGS__);                                                 \
   return packet.data[0];
 
+/*!
+ * @brief Sends the command packet with constant parameters
+ */
+#define SEND_FIXED_CMD_PACKET(...)                                             \
+  GET_FIXED_CMD_PACKET(__VA_ARGS__);                                           \
+  return packet.data[0];
+
 /***************************************************************************
  PUBLIC FUNCTIONS
  ***************************************************************************/
@@ -52,11 +118,14 @@ uint8_t data[] = {__VA_ARGS__};                                                \
 /**************************************************************************/
 /*!
     @brief  Instantiates sensor with Software Serial
-    @param  ss Pointer to SoftwareSerial object
+    @param  serialTX UART TX pin, to the sensor RX
+    @param  serialRX UART RX pin, from the sensor TX
     @param  password 32-bit integer password (default is 0)
+    @param  wakeup Pin of the sensor WAKEUP line (finger detection)
 */
 /**************************************************************************/
-Fingerprint::Fingerprint(PinName serialTX, PinName serialRX, uint32_t password) :   R503Serial(serialTX, serialRX) 
+Fingerprint::Fingerprint(PinName serialTX, PinName serialRX, uint32_t password,
+                         PinName wakeup) :   R503Serial(serialTX, serialRX), detect(wakeup) 
 {
   thePassword = password;
   theAddress = 0xFFFFFFFF;
@@ -68,9 +137,22 @@ Fingerprint::Fingerprint(PinName serialTX, PinName serialRX, uint32_t password)
   device_addr = 0xFFFFFFFF;      ///< The device address (set by getParameters)
   packet_len = 64;   ///< The max packet length (set by getParameters)
   baud_rate = 57600; ///< The UART baud rate (set by getParameters)
-  // Init buffer de reception, les deux pointeurs egaux
-  pe=buffUART;
-  pl=buffUART;
+  autoCommands = true;
+  searchRangeCount = 0;
+  rxState = RX_START_HIGH;
+  rxRemaining = 0;
+  rxSum = 0;
+  rxChecksum = 0;
+  rxOverrun = false;
+  rxErrors = 0;
+  sleeping = false;
+  wakeAckPending = false;
+  indexValid = false;
+  commandRetries = 0;
+  captureRetries = 0;
+  lateReply = false;
+  memset(latencyCount, 0, sizeof(latencyCount));
+  memset(latencyNext, 0, sizeof(latencyNext));
   // active IT sur reception UART vers methode receiveUART
   R503Serial.attach(callback(this,&Fingerprint::receiveUART),UnbufferedSerial::RxIrq);
 }
@@ -83,6 +165,146 @@ Fingerprint::Fingerprint(PinName serialTX, PinName serialRX, uint32_t password)
 /**************************************************************************/
 void Fingerprint::begin(uint32_t baudrate) {
      R503Serial.baud(baudrate);
+     resetReceiver();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Finds the baud rate the sensor currently uses, trying preferred
+   first, then the factory default and the other usual rates. The sensor keeps
+   a baud rate set with setBaudRate() across power cycles
+    @param  preferred Baud rate the sensor is expected to be at
+    @returns The baud rate the sensor answered at, 0 if it never did
+*/
+/**************************************************************************/
+uint32_t Fingerprint::autoBaud(uint32_t preferred) {
+  static const uint32_t rates[] = {57600, 115200, 9600, 19200, 38400};
+  ScopedLock<Mutex> lock(cmdMutex);
+
+  begin(preferred);
+  if (verifyPassword()) {
+    baud_rate = preferred;
+    return preferred;
+  }
+  for (uint32_t rate : rates) {
+    if (rate == preferred)
+      continue;
+    begin(rate);
+    if (verifyPassword()) {
+      baud_rate = rate;
+      return rate;
+    }
+  }
+  return 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Number of commands sent again after a timeout or a bad reply
+    @returns Retry count since startup
+*/
+/**************************************************************************/
+uint32_t Fingerprint::retryCount(void) const {
+  return commandRetries;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Number of received frames dropped for a bad checksum or length
+    @returns Error count since startup
+*/
+/**************************************************************************/
+uint32_t Fingerprint::rxErrorCount(void) const {
+  return rxErrors;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Number of images taken again by captureFeatures() because the
+    previous one was unusable
+    @returns Retry count since startup
+*/
+/**************************************************************************/
+uint32_t Fingerprint::captureRetryCount(void) const {
+  return captureRetries;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Switches the sensor LEDs off and stops listening to its UART, which
+    releases the UART's deep sleep lock. The WAKEUP line still signals a finger.
+    Commands fail right away until wake() is called
+*/
+/**************************************************************************/
+void Fingerprint::sleep(void) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  if (sleeping)
+    return;
+  LEDcontrol(false);
+  LEDcontrol(FINGERPRINT_LED_OFF, 0, FINGERPRINT_LED_BLUE);
+  R503Serial.enable_input(false);
+  sleeping = true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Listens to the sensor UART again after sleep(). The LEDs are left
+    off, the caller sets them to what it wants
+*/
+/**************************************************************************/
+void Fingerprint::wake(void) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  if (!sleeping)
+    return;
+  R503Serial.enable_input(true);
+  resetReceiver();
+  sleeping = false;
+  wakeAckPending = true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets what runs when the sensor acks its first command after
+    wake(), the point where it is usable again. The handler runs on the thread
+    that sent the command, with the command lock held
+    @param  handler Function to call, bound to whatever it needs
+*/
+/**************************************************************************/
+void Fingerprint::attachWakeAck(Callback<void()> handler) {
+  wakeAckHandler = handler;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets what runs when a finger is put on this sensor (falling edge of
+    its WAKEUP line). The handler runs in interrupt context, enableDetect()
+    switches it on
+    @param  handler Function to call, bound to whatever it needs
+*/
+/**************************************************************************/
+void Fingerprint::attachDetect(Callback<void()> handler) {
+  detectHandler = handler;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Starts or stops calling the attachDetect() handler, e.g. while the
+    finger stays on the sensor during an enrolment
+    @param  on true to report detections
+*/
+/**************************************************************************/
+void Fingerprint::enableDetect(bool on) {
+  detect.fall(on ? detectHandler : Callback<void()>());
+}
+
+/**************************************************************************/
+/*!
+    @brief  Number of received bytes dropped because the RX buffer was full
+    @returns Overflow count since startup
+*/
+/**************************************************************************/
+uint32_t Fingerprint::rxOverflowCount(void) const {
+  return rxBuffer.overflowCount();
 }
 
 /**************************************************************************/
@@ -113,7 +335,7 @@ uint8_t Fingerprint::checkPassword(void) {
 */
 /**************************************************************************/
 uint8_t Fingerprint::getParameters(void) {
-  GET_CMD_PACKET(FINGERPRINT_READSYSPARAM);
+  GET_FIXED_CMD_PACKET(FINGERPRINT_READSYSPARAM);
 
   status_reg = ((uint16_t)packet.data[1] << 8) | packet.data[2];
   system_id = ((uint16_t)packet.data[3] << 8) | packet.data[4];
@@ -137,6 +359,89 @@ uint8_t Fingerprint::getParameters(void) {
   return packet.data[0];
 }
 
+/**************************************************************************/
+/*!
+    @brief  Write a system parameter of the sensor (SetSysPara)
+    @param  regAdd Register address, e.g. FINGERPRINT_BAUD_REG_ADDR
+    @param  value Register value
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::writeRegister(uint8_t regAdd, uint8_t value) {
+  SEND_CMD_PACKET(FINGERPRINT_WRITE_REG, regAdd, value);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Switch the sensor and our UART to another baud rate. The link is
+   checked with verifyPassword() at the new rate, and we go back to the
+   previous rate if the sensor doesn't answer there
+    @param  baud 9600 to 115200, a multiple of 9600
+    @returns True if the sensor now talks at baud
+*/
+/**************************************************************************/
+bool Fingerprint::setBaudRate(uint32_t baud) {
+  ScopedLock<Mutex> lock(cmdMutex); // nothing else goes on the UART meanwhile
+  uint32_t previous = baud_rate;
+
+  if (baud % 9600 != 0 || baud < 9600 || baud > 115200)
+    return false;
+  // the ack still comes at the current rate, the sensor switches after it
+  if (writeRegister(FINGERPRINT_BAUD_REG_ADDR, baud / 9600) != FINGERPRINT_OK)
+    return false;
+  ThisThread::sleep_for(std::chrono::milliseconds(FINGERPRINT_BAUD_SWITCH_DELAY));
+
+  begin(baud);
+  if (verifyPassword()) {
+    baud_rate = baud;
+    return true;
+  }
+
+  begin(previous);
+  if (!verifyPassword()) {
+#ifdef FINGERPRINT_DEBUG
+    printf("Sensor lost after switching to %lu baud\n", (unsigned long)baud);
+#endif
+  }
+  return false;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Set the size of the data packets the sensor sends and expects,
+   updates packet_len on success
+    @param  size 32, 64, 128 or 256 bytes
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_BADPACKET</code> for an unsupported size
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::setPacketSize(uint16_t size) {
+  uint8_t code;
+  switch (size) {
+  case 32:
+    code = FINGERPRINT_PACKET_SIZE_32;
+    break;
+  case 64:
+    code = FINGERPRINT_PACKET_SIZE_64;
+    break;
+  case 128:
+    code = FINGERPRINT_PACKET_SIZE_128;
+    break;
+  case 256:
+    code = FINGERPRINT_PACKET_SIZE_256;
+    break;
+  default:
+    return FINGERPRINT_BADPACKET;
+  }
+
+  uint8_t result = writeRegister(FINGERPRINT_PACKET_REG_ADDR, code);
+  if (result == FINGERPRINT_OK)
+    packet_len = size;
+  return result;
+}
+
 /**************************************************************************/
 /*!
     @brief   Ask the sensor to take an image of the finger pressed on surface
@@ -147,7 +452,8 @@ uint8_t Fingerprint::getParameters(void) {
 */
 /**************************************************************************/
 uint8_t Fingerprint::getImage(void) {
-  SEND_CMD_PACKET(FINGERPRINT_GETIMAGE);
+  METRIC_SCOPE(METRIC_IMAGE);
+  SEND_FIXED_CMD_PACKET(FINGERPRINT_GETIMAGE);
 }
 
 /**************************************************************************/
@@ -164,9 +470,73 @@ uint8_t Fingerprint::getImage(void) {
    fingerprint features
 */
 uint8_t Fingerprint::image2Tz(uint8_t slot) {
+  METRIC_SCOPE(METRIC_IMAGE2TZ);
   SEND_CMD_PACKET(FINGERPRINT_IMAGE2TZ, slot);
 }
 
+/**************************************************************************/
+/*!
+    @brief   Continuous capture: getImage() and image2Tz() again and again while
+   the finger stays on the sensor, until features could be extracted or window
+   milliseconds have passed. A partial or messy image is simply taken again
+   instead of failing the sign-in, and the features of every attempt go to the
+   same character buffer, so nothing but the two commands is sent per attempt
+    @param   slot Character buffer for the features, 1 or 2
+    @param   window Milliseconds to keep trying, 0 for a single attempt
+    @returns <code>FINGERPRINT_OK</code> with the features in slot
+    @returns <code>FINGERPRINT_NOFINGER</code> if the finger was lifted
+    @returns The code of the last attempt otherwise
+*/
+/**************************************************************************/
+uint8_t Fingerprint::captureFeatures(uint8_t slot, uint16_t window) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  METRIC_SCOPE(METRIC_CAPTURE);
+  Kernel::Clock::time_point deadline = Kernel::Clock::now() + std::chrono::milliseconds(window);
+
+  while (true) {
+    uint8_t result = getImage();
+    if (result == FINGERPRINT_OK)
+      result = image2Tz(slot);
+    if (result == FINGERPRINT_OK || !captureRetriable(result) ||
+        Kernel::Clock::now() >= deadline)
+      return result;
+    captureRetries++;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief   Wait for the finger to be lifted, checking every
+   FINGERPRINT_REMOVE_POLL ms rather than sending getImage() back to back
+    @param   timeout Milliseconds to wait at most
+    @returns <code>FINGERPRINT_NOFINGER</code> once the sensor is free
+    @returns The last getImage() code if it still sees a finger at timeout
+*/
+/**************************************************************************/
+uint8_t Fingerprint::waitRemoved(uint16_t timeout) {
+  Kernel::Clock::time_point deadline = Kernel::Clock::now() + std::chrono::milliseconds(timeout);
+  uint8_t result = getImage();
+  while (result != FINGERPRINT_NOFINGER && Kernel::Clock::now() < deadline) {
+    ThisThread::sleep_for(std::chrono::milliseconds(FINGERPRINT_REMOVE_POLL));
+    result = getImage();
+  }
+  return result;
+}
+
+// An image the sensor could not use, the next attempt may get a better one; a
+// lifted finger or a link failure (already retried by transact()) end it
+bool Fingerprint::captureRetriable(uint8_t result) {
+  switch (result) {
+    case FINGERPRINT_IMAGEFAIL:
+    case FINGERPRINT_IMAGEMESS:
+    case FINGERPRINT_FEATUREFAIL:
+    case FINGERPRINT_INVALIDIMAGE:
+      return true;
+    default:
+      return false;
+  }
+}
+
 /**************************************************************************/
 /*!
     @brief   Ask the sensor to take two print feature template and create a
@@ -176,7 +546,7 @@ uint8_t Fingerprint::image2Tz(uint8_t slot) {
     @returns <code>FINGERPRINT_ENROLLMISMATCH</code> on mismatch of fingerprints
 */
 uint8_t Fingerprint::createModel(void) {
-  SEND_CMD_PACKET(FINGERPRINT_REGMODEL);
+  SEND_FIXED_CMD_PACKET(FINGERPRINT_REGMODEL);
 }
 
 /**************************************************************************/
@@ -190,8 +560,11 @@ uint8_t Fingerprint::createModel(void) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Fingerprint::storeModel(uint16_t location) {
-  SEND_CMD_PACKET(FINGERPRINT_STORE, 0x01, (uint8_t)(location >> 8),
-                  (uint8_t)(location & 0xFF));
+  GET_CMD_PACKET(FINGERPRINT_STORE, 0x01, (uint8_t)(location >> 8),
+                 (uint8_t)(location & 0xFF));
+  if (packet.data[0] == FINGERPRINT_OK)
+    markSlots(location, 1, true);
+  return packet.data[0];
 }
 
 /**************************************************************************/
@@ -215,7 +588,76 @@ uint8_t Fingerprint::loadModel(uint16_t location) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Fingerprint::getModel(void) {
-  SEND_CMD_PACKET(FINGERPRINT_UPLOAD, 0x01);
+  SEND_FIXED_CMD_PACKET(FINGERPRINT_UPLOAD, 0x01);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Read a template from a character buffer of the sensor (UpChar).
+   The data packets that follow the ACK are written straight into buffer, as
+   many as the sensor sends (their size follows packet_len)
+    @param   slot Character buffer to read, 1 or 2
+    @param   buffer Where the template is written
+    @param   capacity Size of buffer
+    @param   received Set to the number of bytes of template received
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_UPLOADFEATUREFAIL</code> if the sensor can't
+   send the template
+    @returns <code>FINGERPRINT_BUFFERTOOSMALL</code> if the template was cut to
+   capacity
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::uploadModel(uint8_t slot, uint8_t *buffer, uint16_t capacity,
+                                 uint16_t *received) {
+  *received = 0;
+  GET_CMD_PACKET(FINGERPRINT_UPLOAD, slot);
+  if (packet.data[0] != FINGERPRINT_OK)
+    return packet.data[0];
+
+  uint8_t result = FINGERPRINT_OK;
+  uint8_t type = FINGERPRINT_DATAPACKET;
+  while (type != FINGERPRINT_ENDDATAPACKET) 
+  {
+    uint16_t length;
+    uint8_t p = getDataPacket(&type, buffer + *received, capacity - *received, &length);
+    if (p == FINGERPRINT_BUFFERTOOSMALL)
+      result = p; // keep draining the stream so the next command starts clean
+    else if (p != FINGERPRINT_OK)
+      return FINGERPRINT_PACKETRECIEVEERR;
+    *received += length;
+  }
+  return result;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Write a template into a character buffer of the sensor
+   (DownChar), split into data packets of packet_len bytes
+    @param   slot Character buffer to write, 1 or 2
+    @param   buffer The template, as read by uploadModel()
+    @param   length Size of the template
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRESPONSEFAIL</code> if the sensor can't
+   receive the data packets
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::downloadModel(uint8_t slot, const uint8_t *buffer, uint16_t length) {
+  GET_CMD_PACKET(FINGERPRINT_DOWNLOAD, slot);
+  if (packet.data[0] != FINGERPRINT_OK)
+    return packet.data[0];
+
+  uint16_t chunk = packet_len <= FINGERPRINT_MAX_PAYLOAD ? packet_len : FINGERPRINT_MAX_PAYLOAD;
+  uint16_t offset = 0;
+  do 
+  {
+    uint16_t n = length - offset < chunk ? length - offset : chunk;
+    bool last = offset + n >= length;
+    writePacket(last ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET, buffer + offset, n);
+    offset += n;
+  } while (offset < length);
+  return FINGERPRINT_OK;
 }
 
 /**************************************************************************/
@@ -229,8 +671,27 @@ uint8_t Fingerprint::getModel(void) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Fingerprint::deleteModel(uint16_t location) {
-  SEND_CMD_PACKET(FINGERPRINT_DELETE, (uint8_t)(location >> 8),
-                  (uint8_t)(location & 0xFF), 0x00, 0x01);
+  return deleteModels(location, 1);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Ask the sensor to delete consecutive models in a single command
+    @param   location The first model location #
+    @param   count Number of models to delete
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_DELETEFAIL</code> if the models couldn't be
+   deleted
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::deleteModels(uint16_t location, uint16_t count) {
+  GET_CMD_PACKET(FINGERPRINT_DELETE, (uint8_t)(location >> 8),
+                 (uint8_t)(location & 0xFF), (uint8_t)(count >> 8),
+                 (uint8_t)(count & 0xFF));
+  if (packet.data[0] == FINGERPRINT_OK)
+    markSlots(location, count, false);
+  return packet.data[0];
 }
 
 /**************************************************************************/
@@ -243,7 +704,10 @@ uint8_t Fingerprint::deleteModel(uint16_t location) {
     @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
 */
 uint8_t Fingerprint::emptyDatabase(void) {
-  SEND_CMD_PACKET(FINGERPRINT_EMPTY);
+  GET_FIXED_CMD_PACKET(FINGERPRINT_EMPTY);
+  if (packet.data[0] == FINGERPRINT_OK)
+    markSlots(0, FINGERPRINT_MAX_TEMPLATES, false);
+  return packet.data[0];
 }
 
 /**************************************************************************/
@@ -257,20 +721,113 @@ uint8_t Fingerprint::emptyDatabase(void) {
 */
 /**************************************************************************/
 uint8_t Fingerprint::fingerFastSearch(void) {
-  // high speed search of slot #1 starting at page 0x0000 and page #0x00A3
-  GET_CMD_PACKET(FINGERPRINT_HISPEEDSEARCH, 0x01, 0x00, 0x00, 0x00, 0xA3);
+  // high speed search of slot #1 through the whole library
+  return search(FINGERPRINT_HISPEEDSEARCH, 1, 0, capacity);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Same as fingerFastSearch(), limited to part of the library: the
+   search time grows with the number of pages scanned
+    @param   startPage First template ID to compare with
+    @param   pageCount Number of template IDs to compare with
+    @returns <code>FINGERPRINT_OK</code> on fingerprint match success
+    @returns <code>FINGERPRINT_NOTFOUND</code> no match made
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::fingerFastSearch(uint16_t startPage, uint16_t pageCount) {
+  return search(FINGERPRINT_HISPEEDSEARCH, 1, startPage, pageCount);
+}
+
+/**************************************************************************/
+/*!
+    @brief   Capture a finger and search the whole library in one command
+   (AutoIdentify). The matching location is stored in <b>fingerID</b> and the
+   matching confidence in <b>confidence</b>
+    @returns <code>FINGERPRINT_OK</code> on fingerprint match success
+    @returns <code>FINGERPRINT_NOTFOUND</code> no match made
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error,
+   or when the sensor doesn't know the command (autoCommands is then cleared)
+*/
+/**************************************************************************/
+uint8_t Fingerprint::autoIdentify(void) {
+  uint8_t level = security_level ? security_level : 3;
+  uint8_t data[] = {FINGERPRINT_AUTOIDENTIFY, level, 0xFF, 0xFF, 0x00,
+                    FINGERPRINT_AUTO_LED_OFF};
+
   fingerID = 0xFFFF;
   confidence = 0xFFFF;
 
-  fingerID = packet.data[1];
-  fingerID <<= 8;
-  fingerID |= packet.data[2];
+  METRIC_SCOPE(METRIC_AUTO);
+  ScopedLock<Mutex> lock(cmdMutex);
+  uint8_t result = autoCommand(data, sizeof(data), FINGERPRINT_AUTO_STEP_SEARCH);
+  if (result == FINGERPRINT_OK) {
+    fingerID = ((uint16_t)recvPacket[2] << 8) | recvPacket[3];
+    confidence = ((uint16_t)recvPacket[4] << 8) | recvPacket[5];
+  }
+  return result;
+}
 
-  confidence = packet.data[3];
-  confidence <<= 8;
-  confidence |= packet.data[4];
+/**************************************************************************/
+/*!
+    @brief   Capture the finger presses times, merge them and store the template
+   in one command (AutoEnroll). The sensor lights its LED for each capture
+    @param   id The model location #
+    @param   presses How many captures to merge (2 to 6)
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_ENROLLMISMATCH</code> if the captures don't match
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error,
+   or when the sensor doesn't know the command (autoCommands is then cleared)
+*/
+/**************************************************************************/
+uint8_t Fingerprint::autoEnroll(uint16_t id, uint8_t presses) {
+  uint8_t data[] = {FINGERPRINT_AUTOENROLL, (uint8_t)(id >> 8),
+                    (uint8_t)(id & 0xFF), presses, 0x00,
+                    FINGERPRINT_AUTO_OVERWRITE};
 
-  return packet.data[0];
+  ScopedLock<Mutex> lock(cmdMutex);
+  uint8_t p = autoCommand(data, sizeof(data), FINGERPRINT_AUTO_STEP_STORE);
+  if (p == FINGERPRINT_OK)
+    markSlots(id, 1, true);
+  return p;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Capture and search with as few round trips as possible:
+   autoIdentify() when the sensor has it, else captureFeatures() and
+   fingerFastSearch() back to back, the UART being held for the whole sequence.
+   If autoIdentify() got an unusable image, the capture goes on with
+   captureFeatures() while the finger is still down. Only the ranges given to
+   setSearchRanges() are searched, if any
+    @returns <code>FINGERPRINT_OK</code> on fingerprint match success, with
+   <b>fingerID</b> and <b>confidence</b> set
+    @returns The code of the step that failed otherwise
+*/
+/**************************************************************************/
+uint8_t Fingerprint::identify(void) {
+  ScopedLock<Mutex> lock(cmdMutex);
+
+  // AutoIdentify can only search the whole library
+  if (autoCommands && searchRangeCount == 0) {
+    uint8_t result = autoIdentify();
+    if (autoCommands && !captureRetriable(result))
+      return result;
+  }
+
+  uint8_t result = captureFeatures(1, MBED_CONF_APP_FINGERPRINT_CAPTURE_WINDOW_MS);
+  if (result != FINGERPRINT_OK)
+    return result;
+  if (searchRangeCount == 0)
+    return fingerFastSearch();
+
+  for (uint8_t i = 0; i < searchRangeCount; i++) {
+    result = fingerFastSearch(searchRanges[i].start, searchRanges[i].count);
+    if (result != FINGERPRINT_NOTFOUND)
+      return result;
+  }
+  return FINGERPRINT_NOTFOUND;
 }
 
 /**************************************************************************/
@@ -282,9 +839,9 @@ uint8_t Fingerprint::fingerFastSearch(void) {
 /**************************************************************************/
 uint8_t Fingerprint::LEDcontrol(bool on) {
   if (on) {
-    SEND_CMD_PACKET(FINGERPRINT_LEDON);
+    SEND_FIXED_CMD_PACKET(FINGERPRINT_LEDON);
   } else {
-    SEND_CMD_PACKET(FINGERPRINT_LEDOFF);
+    SEND_FIXED_CMD_PACKET(FINGERPRINT_LEDOFF);
   }
 }
 
@@ -319,25 +876,48 @@ uint8_t Fingerprint::LEDcontrol(uint8_t control, uint8_t speed,
 /**************************************************************************/
 uint8_t Fingerprint::fingerSearch(uint8_t slot) {
   // search of slot starting through the capacity
-  GET_CMD_PACKET(FINGERPRINT_SEARCH,
-                 slot,
-                 static_cast<uint8_t>(0x00),
-                 static_cast<uint8_t>(0x00),
-                 static_cast<uint8_t>(capacity >> 8),
-                 static_cast<uint8_t>(capacity & 0xFF));
-
-  fingerID = 0xFFFF;
-  confidence = 0xFFFF;
+  return search(FINGERPRINT_SEARCH, slot, 0, capacity);
+}
 
-  fingerID = packet.data[1];
-  fingerID <<= 8;
-  fingerID |= packet.data[2];
+/**************************************************************************/
+/*!
+    @brief   Same as fingerSearch(slot), limited to part of the library
+   @param slot The slot to use for the print search
+   @param startPage First template ID to compare with
+   @param pageCount Number of template IDs to compare with
+    @returns <code>FINGERPRINT_OK</code> on fingerprint match success
+    @returns <code>FINGERPRINT_NOTFOUND</code> no match made
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::fingerSearch(uint8_t slot, uint16_t startPage,
+                                  uint16_t pageCount) {
+  return search(FINGERPRINT_SEARCH, slot, startPage, pageCount);
+}
 
-  confidence = packet.data[3];
-  confidence <<= 8;
-  confidence |= packet.data[4];
+/**************************************************************************/
+/*!
+    @brief   Limit identify() to some ranges of template IDs, e.g. the ones
+   enrolled for this room. A finger outside of them is reported as not found
+   @param ranges Ranges to search, in order, clamped to the library capacity
+   @param count Number of ranges, 0 to search the whole library again
+*/
+/**************************************************************************/
+void Fingerprint::setSearchRanges(const Fingerprint_Range *ranges,
+                                  uint8_t count) {
+  ScopedLock<Mutex> lock(cmdMutex);
 
-  return packet.data[0];
+  searchRangeCount = 0;
+  for (uint8_t i = 0; i < count && searchRangeCount < FINGERPRINT_MAX_RANGES;
+       i++) {
+    if (ranges[i].start >= capacity || ranges[i].count == 0)
+      continue;
+    Fingerprint_Range &range = searchRanges[searchRangeCount++];
+    range.start = ranges[i].start;
+    range.count = ranges[i].count < capacity - range.start
+                      ? ranges[i].count
+                      : capacity - range.start;
+  }
 }
 
 /**************************************************************************/
@@ -349,7 +929,7 @@ uint8_t Fingerprint::fingerSearch(uint8_t slot) {
 */
 /**************************************************************************/
 uint8_t Fingerprint::getTemplateCount(void) {
-  GET_CMD_PACKET(FINGERPRINT_TEMPLATECOUNT);
+  GET_FIXED_CMD_PACKET(FINGERPRINT_TEMPLATECOUNT);
 
   templateCount = packet.data[1];
   templateCount <<= 8;
@@ -358,6 +938,109 @@ uint8_t Fingerprint::getTemplateCount(void) {
   return packet.data[0];
 }
 
+/**************************************************************************/
+/*!
+    @brief   Ask the sensor which template slots are used, one ReadIndexTable
+   page (256 slots in 32 bytes) at a time for the whole capacity. The bitmap is
+   then kept up to date by storeModel(), autoEnroll(), deleteModels() and
+   emptyDatabase(), and <b>templateCount</b> is set from it
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_PACKETRECIEVEERR</code> on communication error
+*/
+/**************************************************************************/
+uint8_t Fingerprint::readIndexTable(void) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  uint16_t slots = capacity < FINGERPRINT_MAX_TEMPLATES ? capacity
+                                                        : FINGERPRINT_MAX_TEMPLATES;
+  uint8_t pages = (slots + FINGERPRINT_INDEX_PAGE_SLOTS - 1) /
+                  FINGERPRINT_INDEX_PAGE_SLOTS;
+
+  indexValid = false;
+  memset(templateIndex, 0, sizeof(templateIndex));
+  for (uint8_t page = 0; page < pages; page++) {
+    uint8_t data[] = {FINGERPRINT_READINDEXTABLE, page};
+    uint8_t frame[sizeof(data) + FINGERPRINT_FRAME_OVERHEAD];
+    uint16_t frameSize = encodeFingerprintFrame(
+        frame, 0xFFFFFFFF, FINGERPRINT_COMMANDPACKET, data, sizeof(data));
+    Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, 0, nullptr);
+    if (transact(frame, frameSize, &packet) != FINGERPRINT_OK)
+      return FINGERPRINT_PACKETRECIEVEERR;
+    if (packet.data[0] != FINGERPRINT_OK)
+      return packet.data[0];
+    memcpy(templateIndex + page * (FINGERPRINT_INDEX_PAGE_SLOTS / 8),
+           &packet.data[1], FINGERPRINT_INDEX_PAGE_SLOTS / 8);
+  }
+
+  // slots past the capacity are not templates, whatever the sensor sent
+  for (uint16_t i = slots; i < pages * FINGERPRINT_INDEX_PAGE_SLOTS; i++)
+    templateIndex[i / 8] &= ~(1 << (i % 8));
+
+  templateCount = 0;
+  for (uint16_t i = 0; i < (slots + 7) / 8; i++)
+    templateCount += __builtin_popcount(templateIndex[i]);
+  indexValid = true;
+  return FINGERPRINT_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Whether a template slot is used, from the bitmap read by
+   readIndexTable()
+    @param   id The model location #
+    @returns True if the slot holds a template (or the bitmap wasn't read)
+*/
+/**************************************************************************/
+bool Fingerprint::slotUsed(uint16_t id) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  if (!indexValid || id >= FINGERPRINT_MAX_TEMPLATES)
+    return true;
+  return templateIndex[id / 8] & (1 << (id % 8));
+}
+
+/**************************************************************************/
+/*!
+    @brief   First unused template slot, scanning the bitmap read by
+   readIndexTable() a byte at a time
+    @returns The model location #, -1 if the library is full or the bitmap
+   wasn't read
+*/
+/**************************************************************************/
+int Fingerprint::freeSlot(void) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  if (!indexValid)
+    return -1;
+  uint16_t slots = capacity < FINGERPRINT_MAX_TEMPLATES ? capacity
+                                                        : FINGERPRINT_MAX_TEMPLATES;
+  for (uint16_t i = 0; i < (slots + 7) / 8; i++) {
+    if (templateIndex[i] == 0xFF)
+      continue;
+    uint16_t id = i * 8 + __builtin_ctz(~templateIndex[i]);
+    return id < slots ? id : -1;
+  }
+  return -1;
+}
+
+/**************************************************************************/
+/*!
+    @brief   Copy of the bitmap read by readIndexTable(), bit id%8 of byte id/8
+    @param   bitmap Where to copy it
+    @param   size Room in bitmap, in bytes
+    @returns Number of bytes copied, 0 if the bitmap wasn't read
+*/
+/**************************************************************************/
+uint16_t Fingerprint::copyIndexTable(uint8_t *bitmap, uint16_t size) {
+  ScopedLock<Mutex> lock(cmdMutex);
+  if (!indexValid)
+    return 0;
+  uint16_t bytes = ((capacity < FINGERPRINT_MAX_TEMPLATES
+                         ? capacity
+                         : FINGERPRINT_MAX_TEMPLATES) + 7) / 8;
+  if (bytes > size)
+    bytes = size;
+  memcpy(bitmap, templateIndex, bytes);
+  return bytes;
+}
+
 /**************************************************************************/
 /*!
     @brief   Set the password on the sensor (future communication will require
@@ -385,74 +1068,53 @@ uint8_t Fingerprint::setPassword(uint32_t password) {
 
 void Fingerprint::writeStructuredPacket(const Fingerprint_Packet &packet) 
 {
-  // Create a buffer to hold the structured packet data
-  uint8_t buffer[9];  // 9 bytes: 2 for start_code, 4 for address, 1 for type, 2 for wire_length
-
-  // Fill the buffer
-  buffer[0] = static_cast<uint8_t>(packet.start_code >> 8);   // High byte of start_code
-  buffer[1] = static_cast<uint8_t>(packet.start_code & 0xFF); // Low byte of start_code
-  buffer[2] = packet.address[0];
-  buffer[3] = packet.address[1];
-  buffer[4] = packet.address[2];
-  buffer[5] = packet.address[3];
-  buffer[6] = packet.type;
-
-  // Compute the wire_length and add it to the buffer
-  uint16_t wire_length = packet.length + 2;
-  buffer[7] = static_cast<uint8_t>(wire_length >> 8);        // High byte of wire_length
-  buffer[8] = static_cast<uint8_t>(wire_length & 0xFF);      // Low byte of wire_length
-
-  // Send the entire buffer in a single call
-  R503Serial.write(buffer, sizeof(buffer));
-
-  #ifdef FINGERPRINT_DEBUG
-  printf("-> Send packet \n-> ");
-  printf("0x%02X%02X ",(uint8_t)(packet.start_code >> 8),(uint8_t)(packet.start_code & 0xFF));
-  printf(", 0x%02X ",packet.address[0]);
-  printf(", 0x%02X ",packet.address[1]);
-  printf(", 0x%02X ",packet.address[2]);
-  printf(", 0x%02X ",packet.address[3]);
-  printf(", 0x%02X ",packet.type);
-  printf(", 0x%02X ",(uint8_t)(wire_length >> 8));
-  printf(", 0x%02X \n-> Data  ",(uint8_t)(wire_length & 0xFF));
-  #endif
-
-  uint16_t sum = (static_cast<uint8_t>(wire_length >> 8)) + (static_cast<uint8_t>(wire_length & 0xFF)) + packet.type;
-
-  // Buffer to hold packet data for a single write operation, if needed
-  std::vector<uint8_t> dataBuffer;
-  dataBuffer.reserve(packet.length);  // Reserve space for efficiency
-
-  for (uint8_t i = 0; i < packet.length; i++) 
-  {
-    dataBuffer.push_back(packet.data[i]);  // Add to buffer
-    sum += packet.data[i];
+  uint32_t address = ((uint32_t)packet.address[0] << 24) | ((uint32_t)packet.address[1] << 16) |
+                     ((uint32_t)packet.address[2] << 8) | (uint32_t)packet.address[3];
+  uint8_t frame[sizeof(packet.data) + FINGERPRINT_FRAME_OVERHEAD];
+  uint16_t length = packet.length < sizeof(packet.data) ? packet.length : sizeof(packet.data);
 
-  #ifdef FINGERPRINT_DEBUG
-    printf(", 0x%02X ", packet.data[i]);
-  #endif
-  }
+  writeFrame(frame, encodeFingerprintFrame(frame, address, packet.type, packet.data, length));
+}
 
-  // Write all data in a single call if R503Serial.write() requires a buffer and length
-  if (!dataBuffer.empty()) {
-    R503Serial.write(dataBuffer.data(), dataBuffer.size());
-  }
-  //  #ifdef FINGERPRINT_DEBUG
-  //  printf("\n-\n");
-  //  #endif
+/**************************************************************************/
+/*!
+    @brief   Build a packet around payload and send it over UART to the sensor
+    @param   type Command, data or end of data packet
+    @param   payload Bytes to transmit
+    @param   length Size of payload, at most FINGERPRINT_MAX_PAYLOAD
+*/
+/**************************************************************************/
+void Fingerprint::writePacket(uint8_t type, const uint8_t *payload, uint16_t length) 
+{
+  // header, payload and checksum are serialized together and sent in one write
+  uint8_t frame[FINGERPRINT_MAX_PAYLOAD + FINGERPRINT_FRAME_OVERHEAD];
+  if (length > FINGERPRINT_MAX_PAYLOAD)
+    length = FINGERPRINT_MAX_PAYLOAD;
 
-  uint8_t sumBuffer[2];
-  sumBuffer[0] = static_cast<uint8_t>(sum >> 8);     // High byte of sum
-  sumBuffer[1] = static_cast<uint8_t>(sum & 0xFF);   // Low byte of sum
+  writeFrame(frame, encodeFingerprintFrame(frame, theAddress, type, payload, length));
+}
 
-  // Send both bytes in a single write call
-  R503Serial.write(sumBuffer, sizeof(sumBuffer));
+/**************************************************************************/
+/*!
+    @brief   Send an already serialized frame to the sensor in a single write
+    @param   frame The frame bytes
+    @param   size Number of bytes in frame
+*/
+/**************************************************************************/
+void Fingerprint::writeFrame(const uint8_t *frame, uint16_t size) 
+{
+  R503Serial.write(frame, size);
 
 #ifdef FINGERPRINT_DEBUG
-  printf("-> chksum = 0x%02X%02X \n",(uint8_t)(sum >> 8),(uint8_t)(sum & 0xFF));
+  printf("-> Send packet \n-> ");
+  printf("0x%02X%02X ", frame[0], frame[1]);
+  for (uint16_t i = 2; i < 9; i++)
+    printf(", 0x%02X ", frame[i]);
+  printf("\n-> Data  ");
+  for (uint16_t i = 9; i < size - 2; i++)
+    printf(", 0x%02X ", frame[i]);
+  printf("-> chksum = 0x%02X%02X \n", frame[size - 2], frame[size - 1]);
 #endif
-
-  return;
 }
 
 /**************************************************************************/
@@ -468,77 +1130,108 @@ void Fingerprint::writeStructuredPacket(const Fingerprint_Packet &packet)
 /**************************************************************************/
 uint8_t Fingerprint::getStructuredPacket(Fingerprint_Packet *packet, uint16_t timeout) 
 {
-  uint8_t byte;
-  uint16_t idx = 0, timer = 0;
-
-#ifdef FINGERPRINT_DEBUG
-  printf("\n<----------------------packet reception\n<- ");
-#endif
+  uint16_t length;
+  return receivePacket(packet, packet->data, sizeof(packet->data), &length, timeout);
+}
 
-  while (true) 
+/**************************************************************************/
+/*!
+    @brief   Receive one packet of a data stream (after UpChar) straight into
+   the caller's buffer
+    @param   type Set to FINGERPRINT_DATAPACKET, or FINGERPRINT_ENDDATAPACKET
+   for the last packet of the stream
+    @param   buffer Where the payload is written
+    @param   capacity Size of buffer
+    @param   length Set to the payload size of the packet
+    @param   timeout how many milliseconds we're willing to wait
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_BUFFERTOOSMALL</code> if the payload didn't fit,
+   the packet is still consumed
+    @returns <code>FINGERPRINT_TIMEOUT</code> or
+   <code>FINGERPRINT_BADPACKET</code> on failure
+*/
+/**************************************************************************/
+uint8_t Fingerprint::getDataPacket(uint8_t *type, uint8_t *buffer, uint16_t capacity,
+                                   uint16_t *length, uint16_t timeout) 
+{
+  Fingerprint_Packet header(FINGERPRINT_DATAPACKET, 0, nullptr);
+  uint8_t p = receivePacket(&header, buffer, capacity, length, timeout);
+  *type = header.type;
+  if (p != FINGERPRINT_OK)
+    return p;
+  if (header.type != FINGERPRINT_DATAPACKET && header.type != FINGERPRINT_ENDDATAPACKET)
+    return FINGERPRINT_BADPACKET;
+  if (*length > capacity) 
   {
-    while (pl==pe)   // rien n'est arrivé 
-    {
-      ThisThread::sleep_for(1ms);
-      timer++;
-      if (timer >= timeout) 
-      {
-        #ifdef FINGERPRINT_DEBUG
-        printf("Timed out\n");
-        #endif
-        return FINGERPRINT_TIMEOUT;
-      }
-    }
-    byte = readUARTbuff();
+    *length = capacity;
+    return FINGERPRINT_BUFFERTOOSMALL;
+  }
+  return FINGERPRINT_OK;
+}
 
+/**************************************************************************/
+/*!
+    @brief   Take one frame from the reception buffer. rxDecode() only hands
+   over frames whose checksum matched, as a record of address, type, length
+   and payload, so this is a plain copy. The header goes into packet and the
+   payload straight into payload
+    @param   packet Receives start code, address, type and length
+    @param   payload Where the payload is written
+    @param   capacity Size of payload, extra bytes are dropped
+    @param   length Set to the payload size announced by the frame
+    @param   timeout how many milliseconds we're willing to wait
+    @returns <code>FINGERPRINT_OK</code> on success
+    @returns <code>FINGERPRINT_TIMEOUT</code> or
+   <code>FINGERPRINT_BADPACKET</code> on failure
+*/
+/**************************************************************************/
+uint8_t Fingerprint::receivePacket(Fingerprint_Packet *packet, uint8_t *payload,
+                                   uint16_t capacity, uint16_t *length,
+                                   uint16_t timeout) 
+{
+  uint8_t header[FINGERPRINT_RX_RECORD_HEADER];
+  Kernel::Clock::time_point deadline = Kernel::Clock::now() + std::chrono::milliseconds(timeout);
+
+  *length = 0;
+
+  // nothing can come in while the UART input is off
+  if (sleeping)
+    return FINGERPRINT_TIMEOUT;
+
+  // rxDecode() signals each verified frame, so we sleep until one is there
+  // instead of polling for every byte
+  if (!rxFrames.try_acquire_until(deadline))
+  {
     #ifdef FINGERPRINT_DEBUG
-    printf("0x%02X, ",byte);
+    printf("\n<- Timed out\n");
     #endif
-    switch (idx) 
-    {
-        case 0:
-          if (byte != (FINGERPRINT_STARTCODE >> 8))
-            continue;
-          packet->start_code = (uint16_t)byte << 8;
-          break;
-        case 1:
-          packet->start_code |= byte;
-          if (packet->start_code != FINGERPRINT_STARTCODE)
-            return FINGERPRINT_BADPACKET;
-          break;
-        case 2: // 4 bytes for adress
-        case 3:  
-        case 4:
-        case 5:
-          packet->address[idx - 2] = byte;
-          break;
-        case 6:
-          packet->type = byte;
-          break;
-        case 7:
-          packet->length = (uint16_t)byte << 8;
-          break;
-        case 8:
-          packet->length |= byte;
-          #ifdef FINGERPRINT_DEBUG
-           printf("\n<- Data ");
-          #endif
-          break;
-        default:
-          packet->data[idx - 9] = byte;
-          if ((idx - 8) == packet->length) 
-          {
-                #ifdef FINGERPRINT_DEBUG
-                printf("\n<--------------------packet reception OK \n\n");
-                #endif
-                return FINGERPRINT_OK;
-          }
-          break;
-    }
-    idx++;
+    return FINGERPRINT_TIMEOUT;
   }
-  // Shouldn't get here so...
-  // return FINGERPRINT_BADPACKET;
+
+  METRIC_POOL_USE(POOL_SENSOR_RX, rxBuffer.size(), rxBuffer.capacity());
+
+  // the record was published whole, so it can only be missing after a clear()
+  if (rxBuffer.read(header, sizeof(header)) != sizeof(header))
+    return FINGERPRINT_BADPACKET;
+
+  packet->start_code = FINGERPRINT_STARTCODE;
+  memcpy(packet->address, header, 4);
+  packet->type = header[4];
+  // the record holds the length field of the frame, which counts the checksum
+  packet->length = ((uint16_t)header[5] << 8) | header[6];
+  *length = packet->length - 2;
+
+  uint16_t n = *length < capacity ? *length : capacity;
+  rxBuffer.read(payload, n);
+  rxBuffer.skip(*length - n);
+
+#ifdef FINGERPRINT_DEBUG
+  printf("\n<- Received packet type 0x%02X, %d bytes\n<- ", packet->type, *length);
+  for (uint16_t i = 0; i < n; i++)
+    printf("0x%02X, ", payload[i]);
+  printf("\n");
+#endif
+  return FINGERPRINT_OK;
 }
 
 /*
@@ -550,18 +1243,290 @@ Added by Christian Dupaty, STM32 adaptation
  ***************************************************************************/
 
 void Fingerprint::receiveUART(void) {
-    uint8_t c;
-    while(!R503Serial.readable());
-    R503Serial.read(&c, 1);
-    *pe=c;
-    pe++;
-    if (pe>buffUART+sizeof(buffUART)) pe=buffUART;
-}
-
-uint8_t Fingerprint::readUARTbuff(void) {
-   uint8_t c;
-   c=*pl;
-   pl++;
-   if (pl>buffUART+sizeof(buffUART)) pl=buffUART;
-   return c;
+    uint8_t block[FINGERPRINT_RX_BLOCK];
+    size_t count = 0;
+    while (R503Serial.readable()) {
+        R503Serial.read(&block[count++], 1);
+        if (count == sizeof(block)) {
+            rxDecode(block, count);
+            count = 0;
+        }
+    }
+    rxDecode(block, count);
+}
+
+// Sends a command frame and waits for its ack. On a timeout or a garbled reply
+// the command is sent again up to the retries of its profile: a UART glitch
+// costs one more exchange instead of a failed capture. The receiver is emptied
+// before each send so that only a reply to this command is taken. A send that
+// timed out may still be answered after the retry got its ack, that extra ack
+// is dropped before the next command. Called with cmdMutex held
+uint8_t Fingerprint::transact(const uint8_t *frame, uint16_t size,
+                              Fingerprint_Packet *packet) {
+  const Fingerprint_Profile &profile = commandProfile(frame[9]);
+  uint16_t timeout = commandTimeout(profile);
+  bool unanswered = false;
+
+  dropLateReply();
+  for (uint8_t attempt = 0;; attempt++) {
+    resetReceiver();
+    uint32_t errors = rxErrors;
+    Kernel::Clock::time_point sent = Kernel::Clock::now();
+    writeFrame(frame, size);
+    uint8_t p = getStructuredPacket(packet, timeout);
+    if (p == FINGERPRINT_OK && packet->type == FINGERPRINT_ACKPACKET) {
+      if (unanswered) {
+        lateReply = true;
+        lateReplyDeadline = Kernel::Clock::now() + std::chrono::milliseconds(profile.timeout);
+      } else if (packet->data[0] == FINGERPRINT_OK) {
+        recordLatency(profile, Kernel::Clock::now() - sent);
+      }
+      if (wakeAckPending) {
+        wakeAckPending = false;
+        if (wakeAckHandler)
+          wakeAckHandler();
+      }
+      return FINGERPRINT_OK;
+    }
+    // nothing at all came back (as opposed to a frame the decoder rejected),
+    // the sensor may still answer this send
+    if (p == FINGERPRINT_TIMEOUT && rxErrors == errors)
+      unanswered = true;
+    if (attempt >= profile.retries || sleeping)
+      return FINGERPRINT_PACKETRECIEVEERR;
+    commandRetries++;
+  }
+}
+
+// Waits for the ack a retried command may still get for an earlier send, up to
+// the worst case of the command, and drops it
+void Fingerprint::dropLateReply(void) {
+  if (!lateReply)
+    return;
+  lateReply = false;
+  Kernel::Clock::time_point now = Kernel::Clock::now();
+  if (now >= lateReplyDeadline)
+    return;
+  Fingerprint_Packet packet(FINGERPRINT_ACKPACKET, 0, nullptr);
+  getStructuredPacket(&packet, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   lateReplyDeadline - now).count());
+}
+
+const Fingerprint_Profile &Fingerprint::commandProfile(uint8_t command) {
+  for (const Fingerprint_Profile &profile : PROFILES) {
+    if (profile.command == command)
+      return profile;
+  }
+  return DEFAULT_PROFILE;
+}
+
+// The profile's timeout, or with adaptive timeouts twice the 95th percentile
+// of the last successful replies to the command once there are enough of them,
+// never less than a quarter of the profile's. Only OK replies count: a getImage
+// without a finger answers much sooner than one that takes the image
+uint16_t Fingerprint::commandTimeout(const Fingerprint_Profile &profile) {
+#if MBED_CONF_APP_FINGERPRINT_ADAPTIVE_TIMEOUT
+  if (profile.adaptive >= 0 &&
+      latencyCount[profile.adaptive] == FINGERPRINT_ADAPTIVE_SAMPLES) {
+    uint16_t sorted[FINGERPRINT_ADAPTIVE_SAMPLES];
+    memcpy(sorted, latencies[profile.adaptive], sizeof(sorted));
+    std::sort(sorted, sorted + FINGERPRINT_ADAPTIVE_SAMPLES);
+    uint32_t p95 = sorted[(FINGERPRINT_ADAPTIVE_SAMPLES * 95 + 99) / 100 - 1];
+    uint32_t timeout = 2 * (p95 + 1);
+    if (timeout < profile.timeout / 4u)
+      timeout = profile.timeout / 4u;
+    return timeout < profile.timeout ? timeout : profile.timeout;
+  }
+#endif
+  return profile.timeout;
+}
+
+// Keeps the latency of a successful reply for commandTimeout()
+void Fingerprint::recordLatency(const Fingerprint_Profile &profile,
+                                Kernel::Clock::duration latency) {
+  if (profile.adaptive < 0)
+    return;
+  uint8_t slot = profile.adaptive;
+  latencies[slot][latencyNext[slot]] =
+      std::chrono::duration_cast<std::chrono::milliseconds>(latency).count();
+  latencyNext[slot] = (latencyNext[slot] + 1) % FINGERPRINT_ADAPTIVE_SAMPLES;
+  if (latencyCount[slot] < FINGERPRINT_ADAPTIVE_SAMPLES)
+    latencyCount[slot]++;
+}
+
+// Sends an auto command and follows the acks of its steps up to finalStep. The
+// first ack (command check) comes right away and goes through transact(), so a
+// lost or garbled one is retried like for any command; only a sensor that
+// answers and refuses the command doesn't have auto commands. The last ack is
+// left in recvPacket
+uint8_t Fingerprint::autoCommand(const uint8_t *data, uint16_t length,
+                                 uint8_t finalStep) {
+  uint8_t frame[FINGERPRINT_AUTO_PARAMS + FINGERPRINT_FRAME_OVERHEAD];
+  if (length > FINGERPRINT_AUTO_PARAMS)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  uint16_t frameSize = encodeFingerprintFrame(frame, 0xFFFFFFFF,
+                                              FINGERPRINT_COMMANDPACKET, data, length);
+  Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, 0, nullptr);
+  if (transact(frame, frameSize, &packet) != FINGERPRINT_OK)
+    return FINGERPRINT_PACKETRECIEVEERR;
+  // after a retry, the check ack of the other send is skipped by the step loop
+  // like any step short of finalStep
+  lateReply = false;
+  if (packet.data[0] == FINGERPRINT_PACKETRECIEVEERR) {
+    autoCommands = false;
+    return FINGERPRINT_PACKETRECIEVEERR;
+  }
+
+  while (true) {
+    if (packet.data[0] != FINGERPRINT_OK)
+      return packet.data[0];
+    if (packet.data[1] == finalStep) {
+      memcpy(recvPacket, packet.data, sizeof(recvPacket));
+      return FINGERPRINT_OK;
+    }
+    if (getStructuredPacket(&packet, FINGERPRINT_AUTO_TIMEOUT) != FINGERPRINT_OK ||
+        packet.type != FINGERPRINT_ACKPACKET)
+      return FINGERPRINT_PACKETRECIEVEERR;
+  }
+}
+
+// Search command (normal or high speed) of the features in slot over
+// pageCount templates from startPage, sets fingerID and confidence
+uint8_t Fingerprint::search(uint8_t command, uint8_t slot, uint16_t startPage,
+                            uint16_t pageCount) {
+  METRIC_SCOPE(METRIC_SEARCH);
+  GET_CMD_PACKET(command,
+                 slot,
+                 static_cast<uint8_t>(startPage >> 8),
+                 static_cast<uint8_t>(startPage & 0xFF),
+                 static_cast<uint8_t>(pageCount >> 8),
+                 static_cast<uint8_t>(pageCount & 0xFF));
+
+  fingerID = 0xFFFF;
+  confidence = 0xFFFF;
+
+  fingerID = packet.data[1];
+  fingerID <<= 8;
+  fingerID |= packet.data[2];
+
+  confidence = packet.data[3];
+  confidence <<= 8;
+  confidence |= packet.data[4];
+
+  return packet.data[0];
+}
+
+// Keeps the bitmap of used slots and templateCount in step with a successful
+// store or delete, called with cmdMutex held
+void Fingerprint::markSlots(uint16_t id, uint16_t count, bool used) {
+  if (!indexValid)
+    return;
+  for (uint32_t i = id; i < (uint32_t)id + count && i < FINGERPRINT_MAX_TEMPLATES; i++) {
+    uint8_t bit = 1 << (i % 8);
+    if (!(templateIndex[i / 8] & bit) == !used)
+      continue;
+    templateIndex[i / 8] ^= bit;
+    if (used)
+      templateCount++;
+    else
+      templateCount--;
+  }
+}
+
+// Drops whatever was received so far, e.g. bytes garbled by a baud rate change
+void Fingerprint::resetReceiver(void) {
+    core_util_critical_section_enter();
+    rxBuffer.discard();
+    rxBuffer.clear();
+    rxState = RX_START_HIGH;
+    core_util_critical_section_exit();
+    while (rxFrames.try_acquire()) {
+    }
+}
+
+// Frame decoder, fed from the RX interrupt (or a DMA callback) with the bytes
+// in the order they arrived, a block may end anywhere in a frame. Address,
+// type, length and payload are staged in rxBuffer while the checksum is summed
+// up; the consumer only sees the frame once its checksum matched, and a frame
+// announcing more than we can hold is dropped before any payload is taken
+void Fingerprint::rxDecode(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        uint8_t c = data[i];
+        switch (rxState) {
+            case RX_START_HIGH:
+                if (c == (FINGERPRINT_STARTCODE >> 8))
+                    rxState = RX_START_LOW;
+                break;
+            case RX_START_LOW:
+                if (c == (FINGERPRINT_STARTCODE & 0xFF)) {
+                    rxState = RX_ADDRESS;
+                    rxRemaining = 4;
+                    rxOverrun = false;
+                } else if (c != (FINGERPRINT_STARTCODE >> 8)) {
+                    rxState = RX_START_HIGH;
+                }
+                break;
+            case RX_ADDRESS:
+                rxStage(c);
+                if (--rxRemaining == 0)
+                    rxState = RX_TYPE;
+                break;
+            case RX_TYPE:
+                rxStage(c);
+                rxSum = c;
+                rxState = RX_LENGTH_HIGH;
+                break;
+            case RX_LENGTH_HIGH:
+                rxStage(c);
+                rxSum += c;
+                rxRemaining = (uint16_t)c << 8;
+                rxState = RX_LENGTH_LOW;
+                break;
+            case RX_LENGTH_LOW:
+                rxStage(c);
+                rxSum += c;
+                rxRemaining |= c;
+                if (rxRemaining < 2 || rxRemaining > FINGERPRINT_MAX_PAYLOAD + 2) {
+                    // garbled length, look for the next start code
+                    rxBuffer.discard();
+                    rxErrors++;
+                    rxState = RX_START_HIGH;
+                    break;
+                }
+                rxRemaining -= 2;
+                rxState = rxRemaining ? RX_PAYLOAD : RX_CHECKSUM_HIGH;
+                break;
+            case RX_PAYLOAD:
+                rxStage(c);
+                rxSum += c;
+                if (--rxRemaining == 0)
+                    rxState = RX_CHECKSUM_HIGH;
+                break;
+            case RX_CHECKSUM_HIGH:
+                rxChecksum = (uint16_t)c << 8;
+                rxState = RX_CHECKSUM_LOW;
+                break;
+            case RX_CHECKSUM_LOW:
+                rxChecksum |= c;
+                if (rxOverrun) {
+                    rxBuffer.discard();
+                    METRIC_POOL_FAILURE(POOL_SENSOR_RX);
+                } else if (rxChecksum != rxSum) {
+                    rxBuffer.discard();
+                    rxErrors++;
+                } else {
+                    rxBuffer.publish();
+                    rxFrames.release();
+                }
+                rxState = RX_START_HIGH;
+                break;
+        }
+    }
+}
+
+// Stages one byte of the current frame, the frame is dropped at its end if the
+// buffer was full (the lost bytes are counted by rxBuffer)
+void Fingerprint::rxStage(uint8_t c) {
+    if (!rxBuffer.stage(c))
+        rxOverrun = true;
 }
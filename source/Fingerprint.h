@@ -8,6 +8,7 @@
  * @file Fingerprint.h
  */
 #include "mbed.h"
+#include "SPSCRingBuffer.h"
 #include <string.h>
 
 typedef unsigned char uint8_t ;
@@ -57,6 +58,8 @@ typedef unsigned char uint8_t ;
 
 #define FINGERPRINT_TIMEOUT 0xFF   //!< Timeout was reached
 #define FINGERPRINT_BADPACKET 0xFE //!< Bad packet was sent
+#define FINGERPRINT_BUFFERTOOSMALL                                             \
+  0xFD //!< Received data didn't fit in the buffer provided
 
 #define FINGERPRINT_GETIMAGE 0x01 //!< Collect finger image
 #define FINGERPRINT_IMAGE2TZ 0x02 //!< Generate character file from image
@@ -66,8 +69,10 @@ typedef unsigned char uint8_t ;
 #define FINGERPRINT_STORE 0x06          //!< Store template
 #define FINGERPRINT_LOAD 0x07           //!< Read/load template
 #define FINGERPRINT_UPLOAD 0x08         //!< Upload template
+#define FINGERPRINT_DOWNLOAD 0x09       //!< Download template
 #define FINGERPRINT_DELETE 0x0C         //!< Delete templates
 #define FINGERPRINT_EMPTY 0x0D          //!< Empty library
+#define FINGERPRINT_WRITE_REG 0x0E      //!< Write system register (SetSysPara)
 #define FINGERPRINT_READSYSPARAM 0x0F   //!< Read system parameters
 #define FINGERPRINT_SETPASSWORD 0x12    //!< Sets passwords
 #define FINGERPRINT_VERIFYPASSWORD 0x13 //!< Verifies the password
@@ -75,10 +80,30 @@ typedef unsigned char uint8_t ;
   0x1B //!< Asks the sensor to search for a matching fingerprint template to the
        //!< last model generated
 #define FINGERPRINT_TEMPLATECOUNT 0x1D //!< Read finger template numbers
+#define FINGERPRINT_READINDEXTABLE 0x1F //!< Read the bitmap of used template slots
+#define FINGERPRINT_AUTOENROLL                                                 \
+  0x31 //!< Capture, merge and store a template in one command (R503)
+#define FINGERPRINT_AUTOIDENTIFY                                               \
+  0x32 //!< Capture and search in one command (R503)
 #define FINGERPRINT_AURALEDCONFIG 0x35 //!< Aura LED control
 #define FINGERPRINT_LEDON 0x50         //!< Turn on the onboard LED
 #define FINGERPRINT_LEDOFF 0x51        //!< Turn off the onboard LED
 
+#define FINGERPRINT_BAUD_REG_ADDR 0x4     //!< Baud rate register, N x 9600
+#define FINGERPRINT_SECURITY_REG_ADDR 0x5 //!< Security level register
+#define FINGERPRINT_PACKET_REG_ADDR 0x6   //!< Data packet size register
+#define FINGERPRINT_PACKET_SIZE_32 0x0    //!< Data packets of 32 bytes
+#define FINGERPRINT_PACKET_SIZE_64 0x1    //!< Data packets of 64 bytes
+#define FINGERPRINT_PACKET_SIZE_128 0x2   //!< Data packets of 128 bytes
+#define FINGERPRINT_PACKET_SIZE_256 0x3   //!< Data packets of 256 bytes
+
+#define FINGERPRINT_AUTO_LED_OFF 0x01   //!< Auto command: leave the LED alone
+#define FINGERPRINT_AUTO_OVERWRITE 0x08 //!< AutoEnroll: the slot may be reused
+#define FINGERPRINT_AUTO_STEP_SEARCH                                           \
+  0x05 //!< AutoIdentify step carrying the search result
+#define FINGERPRINT_AUTO_STEP_STORE                                            \
+  0x06 //!< AutoEnroll step confirming the template was stored
+
 #define FINGERPRINT_LED_BREATHING 0x01   //!< Breathing light
 #define FINGERPRINT_LED_FLASHING 0x02    //!< Flashing light
 #define FINGERPRINT_LED_ON 0x03          //!< Always on
@@ -91,10 +116,86 @@ typedef unsigned char uint8_t ;
 
 /////////////////////////////////////////////////
 // For debug uncomment this line
- #define FINGERPRINT_DEBUG
+// #define FINGERPRINT_DEBUG
 /////////////////////////////////////////////////
 
 #define DEFAULTTIMEOUT 1000 //!< UART reading timeout in milliseconds
+#define FINGERPRINT_AUTO_TIMEOUT                                               \
+  10000 //!< Milliseconds to wait for each step of an auto command (finger
+        //!< placement included)
+#define FINGERPRINT_AUTO_PARAMS                                                \
+  6 //!< Bytes of an AutoIdentify/AutoEnroll command, instruction code included
+#define FINGERPRINT_REMOVE_POLL                                                \
+  100 //!< Milliseconds between two checks while waiting for the finger to lift
+#define FINGERPRINT_ADAPTIVE_SAMPLES                                           \
+  32 //!< Measurements of a command before its timeout follows them
+#define FINGERPRINT_ADAPTIVE_COMMANDS                                          \
+  2 //!< Commands whose timeout follows their latency (getImage, image2Tz)
+#define FINGERPRINT_MAX_RANGES                                                 \
+  8 //!< Template ID ranges identify() can be limited to
+#define FINGERPRINT_BAUD_SWITCH_DELAY                                          \
+  50 //!< Milliseconds left to the sensor to change its baud rate after the ack
+#define FINGERPRINT_RX_BUFFER_SIZE                                             \
+  1024 //!< UART reception buffer, must be a power of two and hold at least
+       //!< two full data packets (256 bytes payload + 7 bytes record header)
+
+#define FINGERPRINT_INDEX_PAGE_SLOTS                                           \
+  256 //!< Template slots covered by one ReadIndexTable page (32 bytes)
+#define FINGERPRINT_MAX_TEMPLATES                                              \
+  1024 //!< Largest library the index table can describe (4 pages)
+
+#define FINGERPRINT_RX_RECORD_HEADER                                           \
+  7 //!< Address, type and length kept in rxBuffer ahead of each payload
+#define FINGERPRINT_RX_BLOCK                                                   \
+  16 //!< Bytes read from the UART before they go through the frame decoder
+
+#define FINGERPRINT_MAX_PAYLOAD                                                \
+  256 //!< Largest payload we send in one packet (data packet at packet_len 256)
+#define FINGERPRINT_FRAME_OVERHEAD                                             \
+  11 //!< Start code, address, type, length and checksum around the payload
+
+/**************************************************************************/
+/*!
+    @brief   Serialize a packet exactly as it goes on the wire. Also usable at
+   compile time to build the frames of commands that never change
+    @param   frame Output, FINGERPRINT_FRAME_OVERHEAD + length bytes
+    @param   address 32-bit sensor address
+    @param   type Command, data, ack type packet
+    @param   payload Bytes of the payload
+    @param   length Size of payload
+    @returns Number of bytes written to frame
+*/
+/**************************************************************************/
+constexpr uint16_t encodeFingerprintFrame(uint8_t *frame, uint32_t address,
+                                          uint8_t type, const uint8_t *payload,
+                                          uint16_t length) {
+  uint16_t wire_length = length + 2;
+  uint16_t sum = (uint8_t)(wire_length >> 8) + (uint8_t)(wire_length & 0xFF) + type;
+  frame[0] = (uint8_t)(FINGERPRINT_STARTCODE >> 8);
+  frame[1] = (uint8_t)(FINGERPRINT_STARTCODE & 0xFF);
+  frame[2] = (uint8_t)(address >> 24);
+  frame[3] = (uint8_t)(address >> 16);
+  frame[4] = (uint8_t)(address >> 8);
+  frame[5] = (uint8_t)(address & 0xFF);
+  frame[6] = type;
+  frame[7] = (uint8_t)(wire_length >> 8);
+  frame[8] = (uint8_t)(wire_length & 0xFF);
+  for (uint16_t i = 0; i < length; i++) {
+    frame[9 + i] = payload[i];
+    sum += payload[i];
+  }
+  frame[9 + length] = (uint8_t)(sum >> 8);
+  frame[10 + length] = (uint8_t)(sum & 0xFF);
+  return length + FINGERPRINT_FRAME_OVERHEAD;
+}
+
+///! Command frame computed at compile time, for commands without parameters
+template <size_t N> struct Fingerprint_Frame {
+  constexpr Fingerprint_Frame(const uint8_t (&payload)[N]) : bytes() {
+    encodeFingerprintFrame(bytes, 0xFFFFFFFF, FINGERPRINT_COMMANDPACKET, payload, N);
+  }
+  uint8_t bytes[N + FINGERPRINT_FRAME_OVERHEAD]; ///< The frame, ready to send
+};
 
 ///! Helper class to craft UART packets
 struct Fingerprint_Packet 
@@ -130,36 +231,78 @@ struct Fingerprint_Packet
   uint8_t data[64];    ///< The raw buffer for packet payload
 };
 
+///! A range of template IDs (pages) of the sensor library
+struct Fingerprint_Range {
+  uint16_t start; ///< First page
+  uint16_t count; ///< Number of pages
+};
+
+struct Fingerprint_Profile;
+
 ///! Helper class to communicate with and keep state for fingerprint sensors
 class Fingerprint {
 public:
 
-  Fingerprint(PinName serialTX, PinName serialRX, uint32_t password  );
+  Fingerprint(PinName serialTX, PinName serialRX, uint32_t password,
+              PinName wakeup);
 
   void begin(uint32_t baud);
+  uint32_t autoBaud(uint32_t preferred);
 
   bool verifyPassword(void);
   uint8_t getParameters(void);
+  uint8_t writeRegister(uint8_t regAdd, uint8_t value);
+  bool setBaudRate(uint32_t baud);
+  uint8_t setPacketSize(uint16_t size);
 
   uint8_t getImage(void);
   uint8_t image2Tz(uint8_t slot = 1);
+  uint8_t captureFeatures(uint8_t slot, uint16_t window);
+  uint8_t waitRemoved(uint16_t timeout);
   uint8_t createModel(void);
 
   uint8_t emptyDatabase(void);
   uint8_t storeModel(uint16_t id);
   uint8_t loadModel(uint16_t id);
   uint8_t getModel(void);
+  uint8_t uploadModel(uint8_t slot, uint8_t *buffer, uint16_t capacity,
+                      uint16_t *received);
+  uint8_t downloadModel(uint8_t slot, const uint8_t *buffer, uint16_t length);
   uint8_t deleteModel(uint16_t id);
+  uint8_t deleteModels(uint16_t id, uint16_t count);
+  uint8_t readIndexTable(void);
+  bool slotUsed(uint16_t id);
+  int freeSlot(void);
+  uint16_t copyIndexTable(uint8_t *bitmap, uint16_t size);
   uint8_t fingerFastSearch(void);
+  uint8_t fingerFastSearch(uint16_t startPage, uint16_t pageCount);
   uint8_t fingerSearch(uint8_t slot = 1);
+  uint8_t fingerSearch(uint8_t slot, uint16_t startPage, uint16_t pageCount);
+  void setSearchRanges(const Fingerprint_Range *ranges, uint8_t count);
+  uint8_t autoIdentify(void);
+  uint8_t autoEnroll(uint16_t id, uint8_t presses = 2);
+  uint8_t identify(void);
   uint8_t getTemplateCount(void);
   uint8_t setPassword(uint32_t password);
   uint8_t LEDcontrol(bool on);
   uint8_t LEDcontrol(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0);
 
   void writeStructuredPacket(const Fingerprint_Packet &p);
+  void writePacket(uint8_t type, const uint8_t *payload, uint16_t length);
+  void writeFrame(const uint8_t *frame, uint16_t size);
   uint8_t getStructuredPacket(Fingerprint_Packet *p,
                               uint16_t timeout = DEFAULTTIMEOUT);
+  uint8_t getDataPacket(uint8_t *type, uint8_t *buffer, uint16_t capacity,
+                        uint16_t *length, uint16_t timeout = DEFAULTTIMEOUT);
+  uint32_t rxOverflowCount(void) const;
+  uint32_t retryCount(void) const;
+  uint32_t rxErrorCount(void) const;
+  uint32_t captureRetryCount(void) const;
+  void sleep(void);
+  void wake(void);
+  void attachWakeAck(Callback<void()> handler);
+  void attachDetect(Callback<void()> handler);
+  void enableDetect(bool on);
 
   /// The matching location that is set by fingerFastSearch()
   uint16_t fingerID;
@@ -175,21 +318,75 @@ public:
   uint16_t security_level; ///< The security level (set by getParameters)
   uint32_t device_addr;             ///< The device address (set by getParameters)
   uint16_t packet_len;   ///< The max packet length (set by getParameters)
-  uint16_t baud_rate; ///< The UART baud rate (set by getParameters)
+  uint32_t baud_rate; ///< The UART baud rate (set by getParameters)
+  bool autoCommands; ///< False once the sensor turned down AutoIdentify/AutoEnroll
 
 private:
   uint8_t checkPassword(void);
+  uint8_t autoCommand(const uint8_t *data, uint16_t length, uint8_t finalStep);
+  uint8_t transact(const uint8_t *frame, uint16_t size,
+                   Fingerprint_Packet *packet);
+  static const Fingerprint_Profile &commandProfile(uint8_t command);
+  uint16_t commandTimeout(const Fingerprint_Profile &profile);
+  void recordLatency(const Fingerprint_Profile &profile,
+                     Kernel::Clock::duration latency);
+  // latences (ms) des dernieres reponses OK, par commande a timeout adaptatif
+  uint16_t latencies[FINGERPRINT_ADAPTIVE_COMMANDS][FINGERPRINT_ADAPTIVE_SAMPLES];
+  uint8_t latencyCount[FINGERPRINT_ADAPTIVE_COMMANDS];
+  uint8_t latencyNext[FINGERPRINT_ADAPTIVE_COMMANDS];
+  void dropLateReply(void);
+  bool lateReply; // un envoi repete peut encore recevoir un ack
+  Kernel::Clock::time_point lateReplyDeadline; // au plus tard a cette heure
+  uint32_t commandRetries; // commandes renvoyees par transact()
+  uint32_t captureRetries; // images reprises par captureFeatures()
+  static bool captureRetriable(uint8_t result);
+  uint8_t search(uint8_t command, uint8_t slot, uint16_t startPage,
+                 uint16_t pageCount);
+  Fingerprint_Range searchRanges[FINGERPRINT_MAX_RANGES]; // partition de la
+                                                         // bibliotheque
+  uint8_t searchRangeCount;   // 0: toute la bibliotheque
+  Mutex cmdMutex; // une seule commande (et sa reponse) a la fois sur l'UART
+  void markSlots(uint16_t id, uint16_t count, bool used);
+  // emplacements occupes, bit id%8 de l'octet id/8, lu par readIndexTable()
+  uint8_t templateIndex[FINGERPRINT_MAX_TEMPLATES / 8];
+  bool indexValid;     // templateIndex a ete lu et est tenu a jour
+  uint8_t receivePacket(Fingerprint_Packet *packet, uint8_t *payload,
+                        uint16_t capacity, uint16_t *length, uint16_t timeout);
   uint32_t thePassword;
   uint32_t theAddress;
   uint8_t recvPacket[20];
-  uint8_t *pe;  // pointeur ecriture buffer reception UART
-  uint8_t *pl;  // pointeur lecture buffer reception UART
-  uint8_t buffUART[50];  // tampon reception UART
-  void receiveUART(void); // recoit et stocke data dans buffUART 
-  uint8_t readUARTbuff(void);  // retourne data de buffUART
+  // tampon reception UART, rempli par IT et vide par getStructuredPacket()
+  SPSCRingBuffer<uint8_t, FINGERPRINT_RX_BUFFER_SIZE> rxBuffer;
+  void receiveUART(void); // recoit et passe les octets a rxDecode()
+  void rxDecode(const uint8_t *data, size_t size); // decode les trames (IT ou DMA)
+  void rxStage(uint8_t c);     // ajoute un octet a la trame en cours
+  void resetReceiver(void);    // oublie les octets recus (changement de debit)
+  enum RxState : uint8_t {
+    RX_START_HIGH,
+    RX_START_LOW,
+    RX_ADDRESS,
+    RX_TYPE,
+    RX_LENGTH_HIGH,
+    RX_LENGTH_LOW,
+    RX_PAYLOAD,
+    RX_CHECKSUM_HIGH,
+    RX_CHECKSUM_LOW
+  };
+  RxState rxState;      // etape du decodage de la trame en cours
+  uint16_t rxRemaining; // octets restant dans le champ en cours
+  uint16_t rxSum;       // somme type + longueur + donnees
+  uint16_t rxChecksum;  // checksum recu
+  bool rxOverrun;       // rxBuffer plein pendant la trame en cours
+  volatile uint32_t rxErrors; // trames rejetees (checksum ou longueur)
+  Semaphore rxFrames;   // nombre de trames verifiees dans rxBuffer
+  bool sleeping;       // entree UART coupee par sleep()
+  bool wakeAckPending; // pas encore d'ack depuis wake()
+  Callback<void()> wakeAckHandler; // appele au premier ack apres wake()
+  Callback<void()> detectHandler; // appele (IT) quand un doigt est pose
 
 protected:
     UnbufferedSerial      R503Serial;
+    InterruptIn           detect; // ligne WAKEUP du capteur
 };
 
 #endif
@@ -0,0 +1,323 @@
+#include "HttpResponseParser.h"
+
+#include <strings.h>
+
+static const char TOO_LARGE[] = "response too large for the buffer";
+
+/* case insensitive comparison of a span with a literal */
+static bool span_equals(mbed::Span<const char> span, const char *text)
+{
+    size_t length = strlen(text);
+    return (size_t)span.size() == length && strncasecmp(span.data(), text, length) == 0;
+}
+
+HttpResponseParser::HttpResponseParser(char *buffer, size_t capacity) :
+    _buffer(buffer),
+    _capacity(capacity - 1)
+{
+    reset();
+}
+
+void HttpResponseParser::reset()
+{
+    _length = 0;
+    _parsed = 0;
+    _body_start = 0;
+    _body_length = 0;
+    _remaining = 0;
+    _state = STATUS_LINE;
+    _status = -1;
+    _keep_alive = true;
+    _error = nullptr;
+}
+
+HttpResponseParser::Result HttpResponseParser::commit(size_t length)
+{
+    _length += length;
+    return parse();
+}
+
+HttpResponseParser::Result HttpResponseParser::finish()
+{
+    _keep_alive = false;
+    if (_state == BODY_TO_CLOSE) {
+        complete();
+    }
+    if (_state == DONE) {
+        return COMPLETE;
+    }
+    if (_state == ERROR) {
+        return FAILED;
+    }
+    return fail("connection closed before the end of the response");
+}
+
+mbed::Span<const char> HttpResponseParser::header(const char *name) const
+{
+    size_t name_length = strlen(name);
+    const char *end = _buffer + (_state <= HEADERS ? _parsed : _body_start);
+
+    /* the first line is the status line */
+    const char *line = (const char *)memchr(_buffer, '\n', end - _buffer);
+    while (line && ++line < end) {
+        const char *line_end = (const char *)memchr(line, '\n', end - line);
+        if (!line_end) {
+            break;
+        }
+        if ((size_t)(line_end - line) > name_length && line[name_length] == ':'
+                && strncasecmp(line, name, name_length) == 0) {
+            const char *value = line + name_length + 1;
+            while (value < line_end && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            const char *value_end = line_end;
+            while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' ' || value_end[-1] == '\t')) {
+                value_end--;
+            }
+            return mbed::Span<const char>(value, value_end - value);
+        }
+        line = line_end;
+    }
+    return mbed::Span<const char>();
+}
+
+HttpResponseParser::Result HttpResponseParser::parse()
+{
+    const char *line;
+    size_t length;
+
+    while (true) {
+        switch (_state) {
+            case STATUS_LINE:
+                if (!(line = next_line(&length))) {
+                    return need_more();
+                }
+                if (!parse_status_line(line, length)) {
+                    return fail("malformed status line");
+                }
+                _state = HEADERS;
+                break;
+
+            case HEADERS:
+                if (!(line = next_line(&length))) {
+                    return need_more();
+                }
+                if (length == 0) {
+                    if (!end_of_headers()) {
+                        return FAILED;
+                    }
+                } else if (!memchr(line, ':', length)) {
+                    return fail("malformed header");
+                }
+                break;
+
+            case BODY_LENGTH:
+            case CHUNK_DATA:
+                length = _length - _parsed < _remaining ? _length - _parsed : _remaining;
+                append_body(length);
+                _remaining -= length;
+                if (_remaining != 0) {
+                    return need_more();
+                }
+                if (_state == BODY_LENGTH) {
+                    complete();
+                } else {
+                    _state = CHUNK_END;
+                }
+                break;
+
+            case BODY_TO_CLOSE:
+                append_body(_length - _parsed);
+                return need_more();
+
+            case CHUNK_SIZE: {
+                if (!(line = next_line(&length))) {
+                    return need_more();
+                }
+                size_t size = 0;
+                size_t digits = 0;
+                /* anything after the size is a chunk extension, ignored */
+                for (; digits < length; digits++) {
+                    char c = line[digits];
+                    int value = c >= '0' && c <= '9' ? c - '0'
+                              : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                              : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                    if (value < 0) {
+                        break;
+                    }
+                    size = size * 16 + value;
+                }
+                if (digits == 0 || size > _capacity) {
+                    return fail("malformed chunk size");
+                }
+                _remaining = size;
+                _state = size ? CHUNK_DATA : TRAILERS;
+                break;
+            }
+
+            case CHUNK_END:
+                if (!(line = next_line(&length))) {
+                    return need_more();
+                }
+                if (length != 0) {
+                    return fail("malformed chunk");
+                }
+                _state = CHUNK_SIZE;
+                break;
+
+            case TRAILERS:
+                if (!(line = next_line(&length))) {
+                    return need_more();
+                }
+                if (length == 0) {
+                    complete();
+                }
+                break;
+
+            case DONE:
+                return COMPLETE;
+
+            case ERROR:
+                return FAILED;
+        }
+    }
+}
+
+HttpResponseParser::Result HttpResponseParser::need_more()
+{
+    if (_state > HEADERS) {
+        /* what isn't parsed yet goes right after the decoded body, only chunk
+         * framing and trailers are ever dropped from the buffer */
+        size_t body_end = _body_start + _body_length;
+        if (_parsed != body_end) {
+            memmove(_buffer + body_end, _buffer + _parsed, _length - _parsed);
+            _length -= _parsed - body_end;
+            _parsed = body_end;
+        }
+    }
+    if (space() == 0) {
+        return fail(TOO_LARGE);
+    }
+    return NEED_MORE;
+}
+
+bool HttpResponseParser::too_large() const
+{
+    return _error == TOO_LARGE;
+}
+
+HttpResponseParser::Result HttpResponseParser::fail(const char *error)
+{
+    _state = ERROR;
+    _error = error;
+    _keep_alive = false;
+    return FAILED;
+}
+
+const char *HttpResponseParser::next_line(size_t *length)
+{
+    char *line = _buffer + _parsed;
+    char *end = (char *)memchr(line, '\n', _length - _parsed);
+    if (!end) {
+        return nullptr;
+    }
+    _parsed = end + 1 - _buffer;
+    if (end > line && end[-1] == '\r') {
+        end--;
+    }
+    *length = end - line;
+    return line;
+}
+
+bool HttpResponseParser::parse_status_line(const char *line, size_t length)
+{
+    /* HTTP/1.x nnn reason */
+    if (length < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ') {
+        return false;
+    }
+    int status = 0;
+    for (size_t i = 9; i < 12; i++) {
+        if (line[i] < '0' || line[i] > '9') {
+            return false;
+        }
+        status = status * 10 + line[i] - '0';
+    }
+    _status = status;
+    /* HTTP/1.0 closes the connection unless told otherwise */
+    _keep_alive = line[7] != '0';
+    return true;
+}
+
+bool HttpResponseParser::end_of_headers()
+{
+    _body_start = _parsed;
+
+    mbed::Span<const char> connection = header("Connection");
+    if (span_equals(connection, "close")) {
+        _keep_alive = false;
+    } else if (span_equals(connection, "keep-alive")) {
+        _keep_alive = true;
+    }
+
+    if (_status >= 100 && _status < 200) {
+        /* interim response, the real one follows it */
+        size_t left = _length - _parsed;
+        memmove(_buffer, _buffer + _parsed, left);
+        reset();
+        _length = left;
+        return true;
+    }
+    if (_status == 204 || _status == 304) {
+        complete();
+        return true;
+    }
+
+    mbed::Span<const char> encoding = header("Transfer-Encoding");
+    if (encoding.size() >= 7 && span_equals(encoding.subspan(encoding.size() - 7), "chunked")) {
+        _state = CHUNK_SIZE;
+        return true;
+    }
+
+    mbed::Span<const char> content_length = header("Content-Length");
+    if (!content_length.empty()) {
+        size_t value = 0;
+        for (char c : content_length) {
+            if (c < '0' || c > '9') {
+                fail("malformed Content-Length");
+                return false;
+            }
+            value = value * 10 + c - '0';
+            if (value > _capacity) {
+                fail(TOO_LARGE);
+                return false;
+            }
+        }
+        _remaining = value;
+        _state = BODY_LENGTH;
+        if (value == 0) {
+            complete();
+        }
+        return true;
+    }
+
+    /* only the end of the connection delimits this body */
+    _keep_alive = false;
+    _state = BODY_TO_CLOSE;
+    return true;
+}
+
+void HttpResponseParser::append_body(size_t length)
+{
+    size_t body_end = _body_start + _body_length;
+    if (body_end != _parsed) {
+        memmove(_buffer + body_end, _buffer + _parsed, length);
+    }
+    _body_length += length;
+    _parsed += length;
+}
+
+void HttpResponseParser::complete()
+{
+    _state = DONE;
+    _buffer[_body_start + _body_length] = '\0';
+}
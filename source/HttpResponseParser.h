@@ -0,0 +1,117 @@
+/* Incremental HTTP/1.1 response parser
+ *
+ * Bytes are received straight into a buffer owned by the caller and parsed in
+ * place as they arrive: the status line and headers stay at the start of the
+ * buffer and the body follows them, chunked bodies being decoded by moving each
+ * chunk down next to the previous one. Nothing is allocated, status, headers and
+ * body are handed back as spans into the buffer.
+ */
+
+#ifndef HTTP_RESPONSE_PARSER_H
+#define HTTP_RESPONSE_PARSER_H
+
+#include "mbed.h"
+
+struct HttpResponse {
+    int status;                  // -1 when no valid response was received
+    mbed::Span<const char> body; // empty when there is none, null terminated otherwise
+};
+
+class HttpResponseParser {
+public:
+    enum Result {
+        NEED_MORE, // feed it more bytes
+        COMPLETE,  // the whole response is in the buffer
+        FAILED     // see error()
+    };
+
+    /* one byte of the buffer is kept to null terminate the body */
+    HttpResponseParser(char *buffer, size_t capacity);
+
+    /* forget the previous response, the buffer is reused for the next one */
+    void reset();
+
+    /* where the next bytes must be received, and how many fit */
+    char *write_ptr()
+    {
+        return _buffer + _length;
+    }
+
+    size_t space() const
+    {
+        return _capacity - _length;
+    }
+
+    /* parse length bytes just received at write_ptr() */
+    Result commit(size_t length);
+
+    /* the connection was closed by the server */
+    Result finish();
+
+    int status() const
+    {
+        return _status;
+    }
+
+    mbed::Span<const char> body() const
+    {
+        return mbed::Span<const char>(_buffer + _body_start, _body_length);
+    }
+
+    /* value of the header, without surrounding whitespace. Empty if it is not there */
+    mbed::Span<const char> header(const char *name) const;
+
+    /* false when the server announced it closes the connection, or when only closing
+     * it can delimit the body */
+    bool keep_alive() const
+    {
+        return _keep_alive;
+    }
+
+    const char *error() const
+    {
+        return _error;
+    }
+
+    /* the failure is a response that does not fit the buffer */
+    bool too_large() const;
+
+private:
+    enum State {
+        STATUS_LINE,
+        HEADERS,
+        BODY_LENGTH,   // Content-Length bytes left in _remaining
+        BODY_TO_CLOSE, // no framing, the body ends with the connection
+        CHUNK_SIZE,
+        CHUNK_DATA,    // bytes of the current chunk left in _remaining
+        CHUNK_END,     // CRLF after the chunk data
+        TRAILERS,
+        DONE,
+        ERROR
+    };
+
+    Result parse();
+    /* make room for more bytes once everything received is parsed */
+    Result need_more();
+    Result fail(const char *error);
+    /* next CRLF terminated line from the unparsed bytes, nullptr until it is all there */
+    const char *next_line(size_t *length);
+    bool parse_status_line(const char *line, size_t length);
+    bool end_of_headers();
+    void append_body(size_t length);
+    void complete();
+
+    char *_buffer;
+    size_t _capacity;
+    size_t _length;      // bytes in the buffer
+    size_t _parsed;      // first byte not parsed yet
+    size_t _body_start;  // end of the headers
+    size_t _body_length; // decoded body bytes, from _body_start
+    size_t _remaining;
+    State _state;
+    int _status;
+    bool _keep_alive;
+    const char *_error;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/* Idle power saving
+ */
+
+#include "IdleManager.h"
+#include "Metrics.h"
+#include "mbed-trace/mbed_trace.h"
+
+#define TRACE_GROUP "IDLE"
+
+IdleManager::IdleManager(uint32_t timeout_ms, uint32_t wake_budget_ms) :
+    _timeout_ms(timeout_ms),
+    _wake_budget_us(wake_budget_ms * 1000)
+{
+}
+
+void IdleManager::attach(Callback<void()> on_sleep, Callback<void()> on_wake)
+{
+    _on_sleep = on_sleep;
+    _on_wake = on_wake;
+}
+
+Kernel::Clock::duration_u32 IdleManager::timeout() const
+{
+    if (_idle || _timeout_ms == 0) {
+        return Kernel::wait_for_u32_forever;
+    }
+    return std::chrono::milliseconds(_timeout_ms);
+}
+
+void IdleManager::event()
+{
+    WakeClock::time_point now = WakeClock::now();
+    if (!_woken.exchange(true)) {
+        _wake_start = now;
+    }
+}
+
+void IdleManager::idle()
+{
+    if (_idle) {
+        return;
+    }
+    tr_debug("Idle");
+    _woken = false;
+    if (_on_sleep) {
+        _on_sleep();
+    }
+    _idle = true;
+}
+
+void IdleManager::active()
+{
+    if (!_idle) {
+        return;
+    }
+    // the sensors ack a command once they are back, the wake hook only gets
+    // them going
+    _waking = _woken.load();
+    if (_on_wake) {
+        _on_wake();
+    }
+    _idle = false;
+}
+
+void IdleManager::ready()
+{
+    if (!_waking.exchange(false)) {
+        return;
+    }
+
+    /* event() stamped the wake up interrupt before it posted the event being handled */
+    uint32_t us = std::chrono::duration_cast<std::chrono::microseconds>(WakeClock::now() - _wake_start).count();
+#if MBED_CONF_APP_METRICS
+    Metrics::record(METRIC_WAKE, us);
+#endif // MBED_CONF_APP_METRICS
+    tr_debug("Awake in %lu us", (unsigned long)us);
+
+    if (us > _wake_budget_us && !_deep_sleep_locked) {
+        tr_warn("Wake up took %lu us, over the %lu us budget: deep sleep disabled",
+                (unsigned long)us, (unsigned long)_wake_budget_us);
+        sleep_manager_lock_deep_sleep();
+        _deep_sleep_locked = true;
+    }
+}
@@ -0,0 +1,67 @@
+/* Idle power saving
+ *
+ * When no event arrived for a while, the sleep hook switches off what draws
+ * power between users and the MCU is left to the RTOS idle loop, which deep
+ * sleeps as long as no driver holds a deep sleep lock. The wake up sources are
+ * the interrupts that post events (sensor WAKEUP line, keypad rows): the first
+ * event afterwards runs the wake hook before it is handled. The time from the
+ * interrupt of that event to the first sensor ack after the wake hook is
+ * measured on a clock that keeps running in deep sleep, and deep sleep is given
+ * up for plain sleep, which resumes faster, if it goes over the budget.
+ */
+
+#ifndef IDLE_MANAGER_H
+#define IDLE_MANAGER_H
+
+#include "mbed.h"
+#include <atomic>
+#if DEVICE_LPTICKER
+#include "drivers/LowPowerClock.h"
+#endif // DEVICE_LPTICKER
+
+class IdleManager {
+public:
+    /* timeout_ms of 0 never goes idle */
+    IdleManager(uint32_t timeout_ms, uint32_t wake_budget_ms);
+
+    /* on_sleep and on_wake run on the thread that waits for the events */
+    void attach(Callback<void()> on_sleep, Callback<void()> on_wake);
+
+    /* how long to wait for the next event before calling idle() */
+    Kernel::Clock::duration_u32 timeout() const;
+
+    /* an event was posted, callable from an interrupt */
+    void event();
+
+    /* the wait for an event timed out */
+    void idle();
+
+    /* an event is about to be handled: wake up first if idle */
+    void active();
+
+    /* a sensor acked its first command since the wake hook, ends the wake up */
+    void ready();
+
+private:
+#if DEVICE_LPTICKER
+    typedef LowPowerClock WakeClock;
+#else
+    typedef Kernel::Clock WakeClock;
+#endif // DEVICE_LPTICKER
+
+    const uint32_t _timeout_ms;
+    const uint32_t _wake_budget_us;
+    Callback<void()> _on_sleep;
+    Callback<void()> _on_wake;
+    bool _idle = false;
+    bool _deep_sleep_locked = false;
+
+    /* set by the first event after idle() */
+    std::atomic<bool> _woken{false};
+    WakeClock::time_point _wake_start;
+
+    /* from active() to the first ready() after it */
+    std::atomic<bool> _waking{false};
+};
+
+#endif
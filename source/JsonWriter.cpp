@@ -0,0 +1,148 @@
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t capacity) :
+    _buffer(buffer),
+    _capacity(capacity)
+{
+}
+
+JsonWriter &JsonWriter::begin_object()
+{
+    return open('{');
+}
+
+JsonWriter &JsonWriter::end_object()
+{
+    return close('}');
+}
+
+JsonWriter &JsonWriter::begin_array()
+{
+    return open('[');
+}
+
+JsonWriter &JsonWriter::end_array()
+{
+    return close(']');
+}
+
+JsonWriter &JsonWriter::key(const char *name)
+{
+    separator();
+    put('"');
+    put_escaped(name);
+    put('"');
+    put(':');
+    _after_key = true;
+    return *this;
+}
+
+JsonWriter &JsonWriter::string(const char *text)
+{
+    separator();
+    put('"');
+    put_escaped(text);
+    put('"');
+    return *this;
+}
+
+JsonWriter &JsonWriter::number(int64_t value)
+{
+    separator();
+    put_number(value);
+    return *this;
+}
+
+JsonWriter &JsonWriter::quoted_number(int64_t value)
+{
+    separator();
+    put('"');
+    put_number(value);
+    put('"');
+    return *this;
+}
+
+JsonWriter &JsonWriter::open(char c)
+{
+    separator();
+    put(c);
+    if (_depth == MAX_DEPTH) {
+        _overflow = true;
+        return *this;
+    }
+    _depth++;
+    _has_elements &= ~(1u << _depth);
+    return *this;
+}
+
+JsonWriter &JsonWriter::close(char c)
+{
+    put(c);
+    if (_depth == 0) {
+        _overflow = true;
+        return *this;
+    }
+    _depth--;
+    return *this;
+}
+
+void JsonWriter::separator()
+{
+    if (_after_key) {
+        _after_key = false;
+        return;
+    }
+    if (_has_elements & (1u << _depth)) {
+        put(',');
+    }
+    _has_elements |= 1u << _depth;
+}
+
+void JsonWriter::put(char c)
+{
+    if (_length == _capacity) {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = c;
+}
+
+void JsonWriter::put_escaped(const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (; *text; text++) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+        } else if (c < 0x20) {
+            put('\\');
+            put('u');
+            put('0');
+            put('0');
+            put(hex[c >> 4]);
+            put(hex[c & 0xF]);
+        } else {
+            put(c);
+        }
+    }
+}
+
+void JsonWriter::put_number(int64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    if (value < 0) {
+        put('-');
+    }
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    while (count) {
+        put(digits[--count]);
+    }
+}
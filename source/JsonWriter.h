@@ -0,0 +1,62 @@
+/* Fixed buffer JSON writer
+ *
+ * Writes compact JSON (no whitespace) straight into a caller supplied buffer,
+ * adding the commas between members itself. Nothing is allocated: when the
+ * buffer is too small the output is cut and ok() turns false.
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "mbed.h"
+
+class JsonWriter {
+    static constexpr uint8_t MAX_DEPTH = 8;
+
+public:
+    JsonWriter(char *buffer, size_t capacity);
+
+    JsonWriter &begin_object();
+    JsonWriter &end_object();
+    JsonWriter &begin_array();
+    JsonWriter &end_array();
+
+    /* name of the next member of the current object */
+    JsonWriter &key(const char *name);
+
+    JsonWriter &string(const char *text);
+    JsonWriter &number(int64_t value);
+    /* a number sent as a string, "12" */
+    JsonWriter &quoted_number(int64_t value);
+
+    /* bytes written, the output is not null terminated */
+    size_t size() const
+    {
+        return _length;
+    }
+
+    /* everything fit in the buffer and every object and array was closed */
+    bool ok() const
+    {
+        return !_overflow && _depth == 0;
+    }
+
+private:
+    JsonWriter &open(char c);
+    JsonWriter &close(char c);
+    /* comma before any element but the first of its container, none after a key */
+    void separator();
+    void put(char c);
+    void put_escaped(const char *text);
+    void put_number(int64_t value);
+
+    char *_buffer;
+    size_t _capacity;
+    size_t _length = 0;
+    uint32_t _has_elements = 0; // one bit per depth, set once its container has an element
+    uint8_t _depth = 0;
+    bool _after_key = false;
+    bool _overflow = false;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/* 4x4 matrix keypad driver
+ */
+
+#include "Keypad.h"
+#include "mbed.h"
+
+Keypad::Keypad(PinName row1, PinName row2, PinName row3, PinName row4,
+               PinName col1, PinName col2, PinName col3, PinName col4,
+               const char keys[SIZE][SIZE], EventQueue *queue, Callback<void(char)> on_key) :
+    _rows{{row1, PullUp}, {row2, PullUp}, {row3, PullUp}, {row4, PullUp}},
+    _columns{{col1, 0}, {col2, 0}, {col3, 0}, {col4, 0}},
+    _keys(keys),
+    _queue(queue),
+    _on_key(on_key)
+{
+}
+
+void Keypad::start()
+{
+    set_columns(0);
+    _armed = true;
+    for (InterruptIn &row : _rows) {
+        row.fall(callback(this, &Keypad::row_fall));
+    }
+}
+
+/* interrupt: a key went down, scan once the contacts settled */
+void Keypad::row_fall()
+{
+    if (!_armed.exchange(false)) {
+        return;
+    }
+    _queue->call_in(std::chrono::milliseconds(DEBOUNCE_MS), this, &Keypad::scan);
+}
+
+void Keypad::scan()
+{
+    char pressed = read_matrix();
+
+    if (pressed != '\0' && pressed != _pressed) {
+        _on_key(pressed);
+    }
+    _pressed = pressed;
+
+    /* the columns are low again: any row still low means a key is held down */
+    for (InterruptIn &row : _rows) {
+        if (!row.read()) {
+            /* only poll while something is held, to catch the release */
+            _queue->call_in(std::chrono::milliseconds(RELEASE_POLL_MS), this, &Keypad::scan);
+            return;
+        }
+    }
+
+    _armed = true;
+}
+
+/* returns the only key pressed, or '\0' if there are none or several */
+char Keypad::read_matrix()
+{
+    // the row interrupts are not armed while we toggle the columns
+    set_columns(1);
+
+    int counter = 0; // number of keys read as pressed
+    int last_col = -1;
+    int last_row = -1;
+
+    for (int col = 0; col < SIZE; col++) {
+        _columns[col] = 0;
+        for (int row = 0; row < SIZE; row++) {
+            if (!_rows[row].read()) {
+                counter += 1;
+                last_col = col;
+                last_row = row;
+            }
+        }
+        _columns[col] = 1;
+    }
+
+    // back to idle, any key pulls its row low again
+    set_columns(0);
+
+    if (counter == 1) {
+        return _keys[last_row][last_col];
+    }
+    return '\0';
+}
+
+void Keypad::set_columns(int value)
+{
+    for (DigitalOut &column : _columns) {
+        column = value;
+    }
+}
@@ -0,0 +1,46 @@
+/* 4x4 matrix keypad driver
+ *
+ * The columns are held low while idle so that pressing any key pulls its row
+ * low: nothing runs until a row interrupt fires. The matrix is then scanned
+ * (debounced) from an EventQueue and polled only while a key is held down, to
+ * notice its release.
+ */
+
+#ifndef KEYPAD_H
+#define KEYPAD_H
+
+#include "mbed.h"
+#include <atomic>
+
+class Keypad {
+public:
+    static constexpr int SIZE = 4;
+
+    /* rows are the inputs (pressed key reads low), columns the outputs, keys[row][col] the
+     * character of each key. on_key is called from queue for every debounced press */
+    Keypad(PinName row1, PinName row2, PinName row3, PinName row4,
+           PinName col1, PinName col2, PinName col3, PinName col4,
+           const char keys[SIZE][SIZE], EventQueue *queue, Callback<void(char)> on_key);
+
+    /* arm the row interrupts */
+    void start();
+
+private:
+    static constexpr uint32_t DEBOUNCE_MS = 20;
+    static constexpr uint32_t RELEASE_POLL_MS = 20;
+
+    void row_fall();
+    void scan();
+    char read_matrix();
+    void set_columns(int value);
+
+    InterruptIn _rows[SIZE];
+    DigitalOut _columns[SIZE];
+    const char (*_keys)[SIZE];
+    EventQueue *_queue;
+    Callback<void(char)> _on_key;
+    std::atomic<bool> _armed{false};
+    char _pressed = '\0';
+};
+
+#endif
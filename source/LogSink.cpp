@@ -0,0 +1,83 @@
+/* Asynchronous trace output
+ */
+
+#include "LogSink.h"
+#include "Metrics.h"
+#include "mbed-trace/mbed_trace.h"
+
+LogSink *LogSink::_instance = nullptr;
+
+LogSink::LogSink() :
+    _thread(osPriorityLow, MBED_CONF_APP_LOG_THREAD_STACK_SIZE, nullptr, "log")
+{
+}
+
+void LogSink::start()
+{
+    _instance = this;
+    _thread.start(callback(this, &LogSink::run));
+
+    mbed_trace_init();
+    mbed_trace_config_set(TRACE_ACTIVE_LEVEL_ALL);
+    mbed_trace_mutex_wait_function_set(&LogSink::lock);
+    mbed_trace_mutex_release_function_set(&LogSink::unlock);
+    mbed_trace_print_function_set(&LogSink::print);
+}
+
+void LogSink::print(const char *line)
+{
+    _instance->push(line);
+}
+
+void LogSink::lock()
+{
+    _instance->_mutex.lock();
+}
+
+void LogSink::unlock()
+{
+    _instance->_mutex.unlock();
+}
+
+void LogSink::push(const char *line)
+{
+    size_t length = strlen(line);
+
+    /* whole lines only, a cut one would be harder to read than a missing one */
+    size_t used = _buffer.size() + length + 2;
+    if (used > BUFFER_SIZE) {
+        _dropped++;
+        METRIC_POOL_FAILURE(POOL_LOG);
+        return;
+    }
+    METRIC_POOL_USE(POOL_LOG, used, BUFFER_SIZE);
+    for (size_t i = 0; i < length; i++) {
+        _buffer.push(line[i]);
+    }
+    _buffer.push('\r');
+    _buffer.push('\n');
+    _flags.set(PENDING_FLAG);
+}
+
+void LogSink::run()
+{
+    uint32_t reported = 0;
+
+    while (true) {
+        _flags.wait_any(PENDING_FLAG);
+
+        const char *span;
+        size_t length;
+        while ((length = _buffer.peek(&span)) > 0) {
+            fwrite(span, 1, length, stdout);
+            _buffer.consume(length);
+        }
+
+        uint32_t dropped = _dropped;
+        if (dropped != reported) {
+            printf("[log] %lu line(s) dropped\r\n", (unsigned long)(dropped - reported));
+            reported = dropped;
+        }
+        fflush(stdout);
+    }
+}
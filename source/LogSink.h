@@ -0,0 +1,46 @@
+/* Asynchronous trace output
+ *
+ * mbed-trace lines are copied into a ring buffer and written to the console by
+ * a low priority thread, so that a thread logging on the sign-in path never
+ * waits for the 9600 baud UART. When the buffer is full, lines are dropped and
+ * counted rather than blocking. Levels above mbed-trace.max-level are compiled
+ * out by mbed-trace itself.
+ */
+
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include "mbed.h"
+#include "SPSCRingBuffer.h"
+#include <atomic>
+
+class LogSink {
+    static constexpr size_t BUFFER_SIZE = MBED_CONF_APP_LOG_BUFFER_SIZE;
+    static constexpr uint32_t PENDING_FLAG = 1;
+
+public:
+    LogSink();
+
+    /* initialise mbed-trace with this sink as its output, only one sink can be started */
+    void start();
+
+private:
+    /* mbed-trace hooks, they only get plain function pointers */
+    static void print(const char *line);
+    static void lock();
+    static void unlock();
+
+    void push(const char *line);
+    void run();
+
+    static LogSink *_instance;
+
+    /* the trace mutex makes every producer the single producer of the ring */
+    Mutex _mutex;
+    SPSCRingBuffer<char, BUFFER_SIZE> _buffer;
+    EventFlags _flags;
+    Thread _thread;
+    std::atomic<uint32_t> _dropped{0};
+};
+
+#endif
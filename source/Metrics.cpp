@@ -0,0 +1,225 @@
+/* Latency metrics
+ */
+
+#include "Metrics.h"
+#include "JsonWriter.h"
+
+namespace {
+/* threads listed by print_stacks() */
+constexpr size_t MAX_THREADS = 12;
+
+/* bucket i counts durations in [2^(i-1), 2^i) us, the last one everything above */
+constexpr size_t BUCKETS = 24;
+
+struct Histogram {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t buckets[BUCKETS];
+};
+
+const char *const NAMES[METRIC_COUNT] = {
+    "image", "image2tz", "search", "auto_identify", "dns", "connect",
+    "send", "receive", "request", "sign_in", "wake",
+    "capture"
+};
+
+Histogram histograms[METRIC_COUNT];
+
+struct Pool {
+    uint32_t capacity;
+    uint32_t peak;
+    uint32_t failures;
+};
+
+const char *const POOL_NAMES[POOL_COUNT] = {
+    "http_tx", "http_rx", "sensor_rx", "log"
+};
+
+/* since boot, reset() leaves them */
+Pool pools[POOL_COUNT];
+
+size_t bucket(uint32_t us)
+{
+    size_t index = 0;
+    while (us && index < BUCKETS - 1) {
+        us >>= 1;
+        index++;
+    }
+    return index;
+}
+
+/* upper bound of the bucket holding the 95th percentile, at most the max */
+uint32_t p95(const Histogram &histogram)
+{
+    uint32_t rank = (histogram.count * 95 + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) {
+            uint32_t bound = i == BUCKETS - 1 ? histogram.max_us : (1u << i) - 1;
+            return bound < histogram.max_us ? bound : histogram.max_us;
+        }
+    }
+    return histogram.max_us;
+}
+
+/* a consistent copy, record() may run on another thread meanwhile */
+Histogram snapshot(size_t id)
+{
+    core_util_critical_section_enter();
+    Histogram copy = histograms[id];
+    core_util_critical_section_exit();
+    return copy;
+}
+
+Pool pool_snapshot(size_t id)
+{
+    core_util_critical_section_enter();
+    Pool copy = pools[id];
+    core_util_critical_section_exit();
+    return copy;
+}
+}
+
+void Metrics::init()
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    reset();
+}
+
+uint32_t Metrics::now()
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    return DWT->CYCCNT;
+#else
+    return us_ticker_read();
+#endif
+}
+
+uint32_t Metrics::elapsed_us(uint32_t since)
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    /* the counter wraps after 2^32 cycles (53 s at 80 MHz), enough for one step */
+    return (DWT->CYCCNT - since) / (SystemCoreClock / 1000000);
+#else
+    return us_ticker_read() - since;
+#endif
+}
+
+void Metrics::record(MetricId id, uint32_t us)
+{
+    core_util_critical_section_enter();
+    Histogram &histogram = histograms[id];
+    if (histogram.count == 0 || us < histogram.min_us) {
+        histogram.min_us = us;
+    }
+    if (us > histogram.max_us) {
+        histogram.max_us = us;
+    }
+    histogram.count++;
+    histogram.sum_us += us;
+    histogram.buckets[bucket(us)]++;
+    core_util_critical_section_exit();
+}
+
+void Metrics::print()
+{
+    printf("%-14s %6s %9s %9s %9s %9s (us)\r\n", "metric", "count", "min", "avg", "p95", "max");
+    for (size_t id = 0; id < METRIC_COUNT; id++) {
+        Histogram histogram = snapshot(id);
+        if (histogram.count == 0) {
+            continue;
+        }
+        printf("%-14s %6lu %9lu %9lu %9lu %9lu\r\n", NAMES[id], (unsigned long)histogram.count,
+               (unsigned long)histogram.min_us, (unsigned long)(histogram.sum_us / histogram.count),
+               (unsigned long)p95(histogram), (unsigned long)histogram.max_us);
+    }
+
+    printf("%-14s %6s %6s %8s (bytes)\r\n", "pool", "peak", "size", "failures");
+    for (size_t id = 0; id < POOL_COUNT; id++) {
+        Pool pool = pool_snapshot(id);
+        printf("%-14s %6lu %6lu %8lu\r\n", POOL_NAMES[id], (unsigned long)pool.peak,
+               (unsigned long)pool.capacity, (unsigned long)pool.failures);
+    }
+}
+
+void Metrics::print_stacks()
+{
+#if MBED_STACK_STATS_ENABLED
+    mbed_stats_stack_t stats[MAX_THREADS];
+    size_t count = mbed_stats_stack_get_each(stats, MAX_THREADS);
+
+    printf("%-14s %6s %6s (bytes)\r\n", "thread", "max", "size");
+    for (size_t i = 0; i < count; i++) {
+        const char *name = osThreadGetName((osThreadId_t)stats[i].thread_id);
+        printf("%-14s %6lu %6lu\r\n", name ? name : "?", (unsigned long)stats[i].max_size,
+               (unsigned long)stats[i].reserved_size);
+    }
+#endif // MBED_STACK_STATS_ENABLED
+}
+
+void Metrics::write_json(JsonWriter &json)
+{
+    json.begin_array();
+    for (size_t id = 0; id < METRIC_COUNT; id++) {
+        Histogram histogram = snapshot(id);
+        if (histogram.count == 0) {
+            continue;
+        }
+        json.begin_object()
+            .key("name").string(NAMES[id])
+            .key("count").number(histogram.count)
+            .key("min").number(histogram.min_us)
+            .key("avg").number(histogram.sum_us / histogram.count)
+            .key("p95").number(p95(histogram))
+            .key("max").number(histogram.max_us)
+            .end_object();
+    }
+    json.end_array();
+}
+
+void Metrics::pool_use(PoolId id, size_t used, size_t capacity)
+{
+    core_util_critical_section_enter();
+    Pool &pool = pools[id];
+    pool.capacity = capacity;
+    if (used > pool.peak) {
+        pool.peak = used;
+    }
+    core_util_critical_section_exit();
+}
+
+void Metrics::pool_failure(PoolId id)
+{
+    core_util_critical_section_enter();
+    pools[id].failures++;
+    core_util_critical_section_exit();
+}
+
+void Metrics::write_pools_json(JsonWriter &json)
+{
+    json.begin_array();
+    for (size_t id = 0; id < POOL_COUNT; id++) {
+        Pool pool = pool_snapshot(id);
+        json.begin_object()
+            .key("name").string(POOL_NAMES[id])
+            .key("peak").number(pool.peak)
+            .key("size").number(pool.capacity)
+            .key("failures").number(pool.failures)
+            .end_object();
+    }
+    json.end_array();
+}
+
+void Metrics::reset()
+{
+    core_util_critical_section_enter();
+    memset(histograms, 0, sizeof(histograms));
+    core_util_critical_section_exit();
+}
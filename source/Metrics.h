@@ -0,0 +1,104 @@
+/* Latency metrics
+ *
+ * Fixed size histograms of how long the steps of a sign-in take: sensor
+ * commands, DNS, connection and TLS handshake, request send and response
+ * receive. Timestamps come from the DWT cycle counter when the core has one.
+ * Recording is a few instructions inside a critical section, so it can be
+ * left in the hot path. The peak use and the failures of the fixed buffers are
+ * kept the same way. Define the metrics config to false to compile it out.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "mbed.h"
+
+class JsonWriter;
+
+enum MetricId {
+    METRIC_IMAGE,    // getImage()
+    METRIC_IMAGE2TZ, // image2Tz()
+    METRIC_SEARCH,   // fingerSearch() / fingerFastSearch()
+    METRIC_AUTO,     // autoIdentify()
+    METRIC_DNS,      // hostname resolution
+    METRIC_CONNECT,  // TCP connection and TLS handshake
+    METRIC_SEND,     // request written to the socket
+    METRIC_RECEIVE,  // response read from the socket
+    METRIC_REQUEST,  // whole request, reconnection included
+    METRIC_SIGN_IN,  // finger detected to answer shown
+    METRIC_WAKE,     // wake up interrupt after idle to the first sensor ack
+    METRIC_CAPTURE,  // captureFeatures(), every attempt until features or deadline
+    METRIC_COUNT
+};
+
+/* the fixed buffers whose peak use is tracked */
+enum PoolId {
+    POOL_HTTP_TX,   // request headers and JSON body
+    POOL_HTTP_RX,   // response
+    POOL_SENSOR_RX, // sensor UART bytes not decoded yet
+    POOL_LOG,       // trace lines not written yet
+    POOL_COUNT
+};
+
+class Metrics {
+public:
+    /* enable the cycle counter, call once at boot */
+    static void init();
+
+    /* current timestamp, in the unit of elapsed_us() */
+    static uint32_t now();
+
+    static uint32_t elapsed_us(uint32_t since);
+
+    static void record(MetricId id, uint32_t us);
+
+    /* min/avg/p95/max of each metric on the console */
+    static void print();
+
+    /* peak stack use of every thread on the console, needs platform.stack-stats-enabled */
+    static void print_stacks();
+
+    /* the same as a JSON array of objects */
+    static void write_json(JsonWriter &json);
+
+    /* used bytes of a pool after an allocation, kept if it is a new peak. Callable
+     * from an interrupt */
+    static void pool_use(PoolId id, size_t used, size_t capacity);
+
+    /* a request for the pool did not fit */
+    static void pool_failure(PoolId id);
+
+    /* peak use and failures of each pool since boot, as a JSON array of objects */
+    static void write_pools_json(JsonWriter &json);
+
+    static void reset();
+};
+
+/* records the time spent in its scope */
+class ScopedMetric {
+public:
+    ScopedMetric(MetricId id) : _id(id), _start(Metrics::now())
+    {
+    }
+
+    ~ScopedMetric()
+    {
+        Metrics::record(_id, Metrics::elapsed_us(_start));
+    }
+
+private:
+    MetricId _id;
+    uint32_t _start;
+};
+
+#if MBED_CONF_APP_METRICS
+#define METRIC_SCOPE(id) ScopedMetric metric_scope_(id)
+#define METRIC_POOL_USE(id, used, capacity) Metrics::pool_use(id, used, capacity)
+#define METRIC_POOL_FAILURE(id) Metrics::pool_failure(id)
+#else
+#define METRIC_SCOPE(id)
+#define METRIC_POOL_USE(id, used, capacity)
+#define METRIC_POOL_FAILURE(id)
+#endif // MBED_CONF_APP_METRICS
+
+#endif
@@ -0,0 +1,141 @@
+/*!
+ * @file SPSCRingBuffer.h
+ *
+ * Lock-free ring buffer for one producer (typically an interrupt handler) and
+ * one consumer thread.
+ */
+
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**************************************************************************/
+/*!
+    @brief  Fixed capacity single-producer/single-consumer ring buffer. The
+   indices run freely and are masked on access, so all N slots are usable and
+   the producer and consumer never write the same index.
+    @tparam T Element type
+    @tparam N Capacity, must be a power of two
+*/
+/**************************************************************************/
+template <typename T, size_t N>
+class SPSCRingBuffer {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+  SPSCRingBuffer() : head(0), tail(0), overflows(0), staged(0) {}
+
+  /// Producer side: append value, returns false (and counts an overflow) when full
+  bool push(const T &value) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      overflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buffer[h & (N - 1)] = value;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Producer side: append value without making it readable yet, returns
+  /// false (and counts an overflow) when full. publish() hands over all the
+  /// staged elements at once, discard() forgets them
+  bool stage(const T &value) {
+    uint32_t h = head.load(std::memory_order_relaxed) + staged;
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      overflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buffer[h & (N - 1)] = value;
+    staged++;
+    return true;
+  }
+
+  /// Producer side: make the staged elements readable
+  void publish() {
+    head.store(head.load(std::memory_order_relaxed) + staged, std::memory_order_release);
+    staged = 0;
+  }
+
+  /// Producer side: drop the staged elements
+  void discard() { staged = 0; }
+
+  /// Consumer side: number of elements ready to be read
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /// Consumer side: take the oldest element, returns false when empty
+  bool pop(T &value) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t)
+      return false;
+    value = buffer[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side: contiguous span of readable elements (up to the end of
+  /// the storage), release them with consume() once processed
+  size_t peek(const T **span) const {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - t;
+    size_t offset = t & (N - 1);
+    *span = &buffer[offset];
+    return available < N - offset ? available : N - offset;
+  }
+
+  /// Consumer side: drop count elements obtained with peek()
+  void consume(size_t count) {
+    tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  /// Consumer side: copy up to count elements into dst, returns how many
+  size_t read(T *dst, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+      const T *span;
+      size_t n = peek(&span);
+      if (n == 0)
+        break;
+      if (n > count - done)
+        n = count - done;
+      memcpy(dst + done, span, n * sizeof(T));
+      consume(n);
+      done += n;
+    }
+    return done;
+  }
+
+  /// Consumer side: drop up to count elements, returns how many
+  size_t skip(size_t count) {
+    size_t n = size();
+    if (n > count)
+      n = count;
+    consume(n);
+    return n;
+  }
+
+  /// Consumer side: drop everything currently buffered
+  void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+  /// Number of elements rejected because the buffer was full
+  uint32_t overflowCount() const { return overflows.load(std::memory_order_relaxed); }
+
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T buffer[N];
+  std::atomic<uint32_t> head; ///< Written by the producer only
+  std::atomic<uint32_t> tail; ///< Written by the consumer only
+  std::atomic<uint32_t> overflows;
+  uint32_t staged; ///< Elements written past head, producer only
+};
+
+#endif
@@ -0,0 +1,123 @@
+/* Sign-in journal
+ */
+
+#include "SignInJournal.h"
+#include "mbed.h"
+#include "mbed-trace/mbed_trace.h"
+
+#define TRACE_GROUP "JRNL"
+
+namespace {
+struct JournalMeta {
+    uint32_t head;
+    uint32_t tail;
+    uint16_t boot;
+};
+
+const char META_KEY[] = "journal";
+}
+
+SignInJournal::SignInJournal(TDBStore *store) :
+    _store(store)
+{
+}
+
+int SignInJournal::init()
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    JournalMeta meta = {};
+    size_t actual = 0;
+    int result = _store->get(META_KEY, &meta, sizeof(meta), &actual);
+    if (result == MBED_SUCCESS && actual == sizeof(meta)) {
+        _head = meta.head;
+        _tail = meta.tail;
+        _boot = meta.boot + 1;
+    }
+    _ready = true;
+    save_meta();
+
+    tr_info("Journal: %lu sign-in(s) waiting for upload", (unsigned long)(_head - _tail));
+    return MBED_SUCCESS;
+}
+
+bool SignInJournal::append(uint16_t fingerprint)
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if (!_ready) {
+        return false;
+    }
+
+    SignInRecord record = {};
+    record.seq = _head;
+    record.fingerprint = fingerprint;
+    record.boot = _boot;
+    record.time_ms = Kernel::Clock::now().time_since_epoch().count();
+
+    char name[16];
+    key(name, record.seq);
+    int result = _store->set(name, &record, sizeof(record), 0);
+    if (result != MBED_SUCCESS) {
+        tr_error("Error! journal write returned: %d", result);
+        return false;
+    }
+
+    _head++;
+    save_meta();
+    return true;
+}
+
+size_t SignInJournal::peek(SignInRecord *records, size_t max)
+{
+    ScopedLock<Mutex> lock(_mutex);
+    size_t count = 0;
+
+    for (uint32_t seq = _tail; seq != _head && count < max; seq++) {
+        char name[16];
+        key(name, seq);
+        size_t actual = 0;
+        if (_store->get(name, &records[count], sizeof(SignInRecord), &actual) == MBED_SUCCESS
+                && actual == sizeof(SignInRecord)) {
+            count++;
+        } else if (count == 0) {
+            /* lost record (e.g. power cut while writing): skip it */
+            _tail = seq + 1;
+        } else {
+            break;
+        }
+    }
+    return count;
+}
+
+void SignInJournal::drop(size_t count)
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    while (count-- && _tail != _head) {
+        char name[16];
+        key(name, _tail);
+        _store->remove(name);
+        _tail++;
+    }
+    save_meta();
+}
+
+size_t SignInJournal::size()
+{
+    ScopedLock<Mutex> lock(_mutex);
+    return _head - _tail;
+}
+
+void SignInJournal::key(char *buffer, uint32_t seq)
+{
+    snprintf(buffer, 16, "e%08lx", (unsigned long)seq);
+}
+
+void SignInJournal::save_meta()
+{
+    JournalMeta meta = {_head, _tail, _boot};
+    int result = _store->set(META_KEY, &meta, sizeof(meta), 0);
+    if (result != MBED_SUCCESS) {
+        tr_error("Error! journal meta write returned: %d", result);
+    }
+}
@@ -0,0 +1,58 @@
+/* Sign-in journal
+ *
+ * Sign-ins are written to the TDBStore on internal flash as soon as they happen,
+ * so that they survive a reset or an unreachable server, and removed once the
+ * uploader got them accepted.
+ */
+
+#ifndef SIGN_IN_JOURNAL_H
+#define SIGN_IN_JOURNAL_H
+
+#include "mbed.h"
+#include "TDBStore.h"
+
+struct SignInRecord {
+    uint32_t seq;         // position in the journal
+    uint16_t fingerprint; // template ID matched by the sensor
+    uint16_t boot;        // boot counter when it was recorded
+    uint64_t time_ms;     // Kernel::Clock time when it was recorded
+};
+
+class SignInJournal {
+public:
+    /* store must be initialized before init() */
+    SignInJournal(TDBStore *store);
+
+    /* find where the journal stands, returns a TDBStore error */
+    int init();
+
+    /* record a sign-in, returns false if it could not be written */
+    bool append(uint16_t fingerprint);
+
+    /* copy up to max of the oldest records, returns how many */
+    size_t peek(SignInRecord *records, size_t max);
+
+    /* forget the count oldest records, once they are uploaded */
+    void drop(size_t count);
+
+    size_t size();
+
+    /* boot counter of this run, to tell whether a record's time is comparable to now */
+    uint16_t boot() const
+    {
+        return _boot;
+    }
+
+private:
+    static void key(char *buffer, uint32_t seq);
+    void save_meta();
+
+    TDBStore *_store;
+    Mutex _mutex;
+    bool _ready = false;
+    uint32_t _head = 0; // next sequence number to write
+    uint32_t _tail = 0; // oldest record not uploaded yet
+    uint16_t _boot = 0;
+};
+
+#endif
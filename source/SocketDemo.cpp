@@ -0,0 +1,331 @@
+/* HTTP client of the reader
+ */
+
+#include "SocketDemo.h"
+#include "mbed-trace/mbed_trace.h"
+#include <algorithm>
+#include <new>
+
+#if MBED_CONF_APP_USE_TLS_SOCKET
+#include "root_ca_cert.h"
+
+#ifndef DEVICE_TRNG
+#error "mbed-os-example-tls-socket requires a device which supports TRNG"
+#endif
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+
+#define TRACE_GROUP "HTTP"
+
+bool span_equals(mbed::Span<const char> span, const char* text)
+{
+    size_t length = strlen(text);
+    return (size_t)span.size() == length && memcmp(span.data(), text, length) == 0;
+}
+
+mbed::Span<const char> json_string(mbed::Span<const char> json, const char* key)
+{
+    size_t key_length = strlen(key);
+    const char* end = json.data() + json.size();
+
+    for (const char* p = json.data(); p + key_length + 2 <= end; p++) {
+        if (*p != '"' || p[key_length + 1] != '"' || memcmp(p + 1, key, key_length) != 0) {
+            continue;
+        }
+        const char* value = p + key_length + 2;
+        while (value < end && (*value == ' ' || *value == ':')) {
+            value++;
+        }
+        if (value == end || *value != '"') {
+            return {};
+        }
+        const char* value_end = ++value;
+        while (value_end < end && *value_end != '"') {
+            value_end += *value_end == '\\' ? 2 : 1;
+        }
+        if (value_end >= end) {
+            return {};
+        }
+        return mbed::Span<const char>(value, value_end - value);
+    }
+    return {};
+}
+
+SocketDemo::SocketDemo(NetworkInterface* net, EventQueue* queue, int timeout_ms) :
+    _net(net),
+    _timeout_ms(timeout_ms),
+    _dns(net, queue, std::chrono::seconds(MBED_CONF_APP_DNS_CACHE_TTL))
+{
+#if MBED_CONF_APP_USE_TLS_SOCKET
+    /* the CA chain is parsed once and shared by every connection we open */
+    mbedtls_x509_crt_init(&_cacert);
+    int ret = mbedtls_x509_crt_parse(&_cacert, reinterpret_cast<const unsigned char *>(root_ca_cert),
+                                     sizeof(root_ca_cert));
+    if (ret != 0) {
+        tr_error("Error: mbedtls_x509_crt_parse() returned -0x%04X", -ret);
+    }
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+}
+
+SocketDemo::~SocketDemo()
+{
+    closeSocket();
+#if MBED_CONF_APP_USE_TLS_SOCKET
+    mbedtls_x509_crt_free(&_cacert);
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+}
+
+bool SocketDemo::initSocket() {
+    // always the same storage, a reconnection doesn't touch the heap
+    _socket = new (_socket_storage) SocketType;
+
+#if MBED_CONF_APP_USE_TLS_SOCKET
+    _socket->set_ca_chain(&_cacert);
+    _socket->set_hostname(MBED_CONF_APP_HOSTNAME);
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+
+    /* opening the socket only allocates resources */
+    nsapi_size_or_error_t result = _socket->open(_net);
+    if (result != 0) {
+        tr_error("Error! _socket->open() returned: %d", result);
+        return false;
+    }
+    _socket->set_timeout(_timeout_ms);
+    return true;
+}
+
+bool SocketDemo::connectSocket(SocketAddress& address) {
+    /* we are connected to the network but since we're using a connection oriented
+    * protocol we still need to open a connection on the socket */
+    tr_debug("Opening connection to remote port %d", REMOTE_PORT);
+    METRIC_SCOPE(METRIC_CONNECT);
+    nsapi_size_or_error_t result = _socket->connect(address);
+    if (result != 0) {
+        tr_error("Error! _socket->connect() returned: %d", result);
+        return false;
+    }
+    return true;
+}
+
+void SocketDemo::closeSocket() {
+    if (!_socket) {
+        return;
+    }
+    _socket->set_timeout(0); // Force TLS connection reset
+    _socket->close();
+    _socket->~SocketType();
+    _socket = nullptr;
+    _connected = false;
+}
+
+bool SocketDemo::connect() {
+    if (_connected) {
+        return true;
+    }
+    closeSocket();
+
+    if (!initSocket()) {
+        closeSocket();
+        return false;
+    }
+
+    SocketAddress address;
+    if (!resolve_hostname(address)) {
+        closeSocket();
+        return false;
+    }
+    address.set_port(REMOTE_PORT);
+
+    if (!connectSocket(address)) {
+        /* the cached address may be the reason, look it up again next time */
+        _dns.invalidate(MBED_CONF_APP_HOSTNAME);
+        closeSocket();
+        return false;
+    }
+    _connected = true;
+    return true;
+}
+
+void SocketDemo::warm_up() {
+    ScopedLock<Mutex> lock(_mutex);
+    connect();
+}
+
+bool SocketDemo::apiPing() {
+    ScopedLock<Mutex> lock(_mutex);
+    if (!begin_request("GET", "/api/ping", false)) {
+        return false;
+    }
+    HttpResponse response = request("GET", "/api/ping");
+    if (span_equals(json_string(response.body, "message"), "pong")) {
+        tr_info("JSON contains message: pong");
+    }
+    return response.status >= 200 && response.status < 500;
+}
+
+HttpResponse SocketDemo::post(const char* endpoint, const JsonWriter& json) {
+    if (!json.ok()) {
+        tr_error("Error: JSON body of %s does not fit the request buffer", endpoint);
+        METRIC_POOL_FAILURE(POOL_HTTP_TX);
+        return {-1, {}};
+    }
+    end_request(json.size());
+    return request("POST", endpoint);
+}
+
+HttpResponse SocketDemo::request(const char* method, const char* endpoint) {
+    ScopedLock<Mutex> lock(_mutex);
+    METRIC_SCOPE(METRIC_REQUEST);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = _connected;
+        if (!connect()) {
+            return {-1, {}};
+        }
+
+        tr_debug("Sending HTTP %s Request to %s...", method, endpoint);
+        if (!send_http_request(method)) {
+            closeSocket();
+            if (reused) {
+                continue;
+            }
+            return {-1, {}};  // Return an error code (-1) and an empty body if the request fails
+        }
+
+        tr_debug("Waiting for HTTP %s Response...", method);
+        size_t received = 0;
+        HttpResponse response = receive_http_response(&received);
+
+        if (!_keep_alive) {
+            closeSocket();
+        }
+        if (received == 0 && reused) {
+            continue;
+        }
+        return response;  // Return the status code and the response body, empty if the response is invalid
+    }
+    return {-1, {}};
+}
+
+bool SocketDemo::resolve_hostname(SocketAddress &address)
+{
+    METRIC_SCOPE(METRIC_DNS);
+    /* only waits on the module when the cache is cold, stale entries are refreshed in the background */
+    return _dns.resolve(MBED_CONF_APP_HOSTNAME, &address) == NSAPI_ERROR_OK;
+}
+
+bool SocketDemo::begin_request(const char* method, const char* endpoint, bool has_body)
+{
+    int length;
+    if (has_body) {
+        length = snprintf(_tx_buffer, sizeof(_tx_buffer),
+                "%s %s HTTP/1.1\r\n"
+                "Host: " MBED_CONF_APP_HOSTNAME "\r\n"
+                "Content-Type: application/json\r\n"
+                "Connection: %s\r\n"
+                "Content-Length:%*s\r\n"
+                "\r\n",
+                method, endpoint, CONNECTION_HEADER, (int)CONTENT_LENGTH_WIDTH, "");
+    } else {
+        length = snprintf(_tx_buffer, sizeof(_tx_buffer),
+                "%s %s HTTP/1.1\r\n"
+                "Host: " MBED_CONF_APP_HOSTNAME "\r\n"
+                "Connection: %s\r\n"
+                "\r\n",
+                method, endpoint, CONNECTION_HEADER);
+    }
+    if (length < 0 || (size_t)length >= sizeof(_tx_buffer)) {
+        tr_error("Error: %s %s request headers do not fit the request buffer", method, endpoint);
+        METRIC_POOL_FAILURE(POOL_HTTP_TX);
+        return false;
+    }
+    _tx_length = length;
+    METRIC_POOL_USE(POOL_HTTP_TX, _tx_length, sizeof(_tx_buffer));
+    return true;
+}
+
+void SocketDemo::end_request(size_t body_length)
+{
+    char* field = _tx_buffer + _tx_length - 4 - CONTENT_LENGTH_WIDTH;
+    char digits[CONTENT_LENGTH_WIDTH + 1];
+    snprintf(digits, sizeof(digits), "%*u", (int)CONTENT_LENGTH_WIDTH, (unsigned)body_length);
+    memcpy(field, digits, CONTENT_LENGTH_WIDTH);
+    _tx_length += body_length;
+    METRIC_POOL_USE(POOL_HTTP_TX, _tx_length, sizeof(_tx_buffer));
+}
+
+bool SocketDemo::send_http_request(const char* method)
+{
+    METRIC_SCOPE(METRIC_SEND);
+    nsapi_size_t bytes_to_send = _tx_length;
+    nsapi_size_or_error_t bytes_sent = 0;
+    nsapi_size_t offset = 0;
+
+    tr_debug("Sending %s request:\n%.*s", method, (int)_tx_length, _tx_buffer);
+
+    while (bytes_to_send) {
+        bytes_sent = _socket->send(_tx_buffer + offset, bytes_to_send);
+        if (bytes_sent < 0) {
+            tr_error("Error! _socket->send() returned: %d", bytes_sent);
+            return false;
+        } else {
+            tr_debug("Sent %d bytes", bytes_sent);
+        }
+
+        offset += bytes_sent;
+        bytes_to_send -= bytes_sent;
+    }
+
+    tr_debug("Complete %s request sent", method);
+
+    return true;
+}
+
+HttpResponse SocketDemo::receive_http_response(size_t* received_bytes) {
+    METRIC_SCOPE(METRIC_RECEIVE);
+    HttpResponseParser parser(_rx_buffer, sizeof(_rx_buffer));
+    HttpResponseParser::Result result = HttpResponseParser::NEED_MORE;
+
+    *received_bytes = 0;
+
+    while (result == HttpResponseParser::NEED_MORE) {
+        nsapi_size_or_error_t received = _socket->recv(parser.write_ptr(), parser.space());
+        if (received < 0) {
+            tr_error("Error! _socket->recv() returned: %d", received);
+            _keep_alive = false;
+            return {-1, {}};
+        }
+        if (received == 0) {
+            // The server closed the connection
+            result = parser.finish();
+            break;
+        }
+        *received_bytes += received;
+        result = parser.commit(received);
+    }
+
+    _keep_alive = HTTP_KEEP_ALIVE && parser.keep_alive();
+    // chunk framing is dropped from the buffer as it is parsed, it can hold less
+    METRIC_POOL_USE(POOL_HTTP_RX, std::min(*received_bytes, sizeof(_rx_buffer)), sizeof(_rx_buffer));
+
+    if (result != HttpResponseParser::COMPLETE) {
+        if (parser.too_large()) {
+            METRIC_POOL_FAILURE(POOL_HTTP_RX);
+        }
+        // What is left of the response would be read as the next one
+        tr_error("Error: invalid response after %d bytes: %s", (int)*received_bytes, parser.error());
+        _keep_alive = false;
+        return {parser.status(), {}};
+    }
+
+    mbed::Span<const char> version = parser.header("X-Auth-Version");
+    if (!version.empty() && _on_auth_version) {
+        _on_auth_version(strtoul(version.data(), nullptr, 10));
+    }
+    mbed::Span<const char> ranges = parser.header("X-Search-Ranges");
+    if (!ranges.empty() && _on_search_ranges) {
+        _on_search_ranges(ranges);
+    }
+
+    tr_debug("Received JSON response:\n%.*s", (int)parser.body().size(), parser.body().data());
+    return {parser.status(), parser.body()};
+}
@@ -0,0 +1,172 @@
+/* HTTP client of the reader
+ *
+ * One persistent connection (TLS or plain TCP) to the server, kept open between
+ * requests when keep-alive is enabled and reopened transparently when the server
+ * dropped it. Requests are built in a fixed TX buffer and responses parsed in
+ * place in a fixed RX buffer, the headers the server uses to push state
+ * (X-Auth-Version, X-Search-Ranges) are handed to attached callbacks. Every
+ * request holds the mutex, so several threads can share one instance.
+ */
+
+#ifndef SOCKET_DEMO_H
+#define SOCKET_DEMO_H
+
+#include "mbed.h"
+#include "DnsCache.h"
+#include "HttpResponseParser.h"
+#include "JsonWriter.h"
+#include "Metrics.h"
+
+#if MBED_CONF_APP_USE_TLS_SOCKET
+#include "mbedtls/x509_crt.h"
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+
+/* exact comparison of a span with a string */
+bool span_equals(mbed::Span<const char> span, const char* text);
+
+/* value of the string member key of a (flat) JSON object, without the quotes. Empty
+ * if there is no such member */
+mbed::Span<const char> json_string(mbed::Span<const char> json, const char* key);
+
+class SocketDemo {
+    static constexpr size_t MAX_MESSAGE_RECEIVED_LENGTH = 1000;
+    static constexpr size_t MAX_MESSAGE_SENT_LENGTH = 1536;
+    /* digits reserved for the body length, bodies can't be larger than the buffer anyway */
+    static constexpr size_t CONTENT_LENGTH_WIDTH = 4;
+    static constexpr int SOCKET_TIMEOUT_MS = 10000;
+
+#if MBED_CONF_APP_USE_TLS_SOCKET
+    static constexpr size_t REMOTE_PORT = 443; // tls port
+    typedef TLSSocket SocketType;
+#else
+    static constexpr size_t REMOTE_PORT = 80; // standard HTTP port
+    typedef TCPSocket SocketType;
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+
+public:
+    /* timeout_ms bounds every socket operation, a long poll needs more than the default */
+    SocketDemo(NetworkInterface* net, EventQueue* queue, int timeout_ms = SOCKET_TIMEOUT_MS);
+    ~SocketDemo();
+
+    /* open the connection ahead of a request, meant to run on the network thread while
+     * the caller prepares the request: the request then waits for it to finish */
+    void warm_up();
+
+    /* true when the server answered, whatever it thought of the request (below 500) */
+    bool apiPing();
+
+    /* The body of a response lives in the RX buffer, which the next request overwrites:
+     * the returned response only carries the status, read_body(const HttpResponse&) gets
+     * the body while the mutex is still held and must copy out whatever it needs. It is
+     * only called when a response came back */
+    template <typename R>
+    HttpResponse apiGET(const char* endpoint, R read_body) {
+        ScopedLock<Mutex> lock(_mutex);
+        if (!begin_request("GET", endpoint, false)) {
+            return {-1, {}};
+        }
+        return read(request("GET", endpoint), read_body);
+    }
+
+    HttpResponse apiGET(const char* endpoint) {
+        return apiGET(endpoint, [](const HttpResponse&) {});
+    }
+
+    /* called with the access rules version the server announces in its responses */
+    void attach_auth_version(Callback<void(uint32_t)> on_version) {
+        _on_auth_version = on_version;
+    }
+
+    /* called with the value of the X-Search-Ranges header, the template IDs the
+     * server expects at this reader */
+    void attach_search_ranges(Callback<void(mbed::Span<const char>)> on_ranges) {
+        _on_search_ranges = on_ranges;
+    }
+
+    /* POST the JSON body written by write_body(JsonWriter&), straight into the TX buffer
+     * after the headers, the response body goes to read_body like with apiGET() */
+    template <typename F, typename R>
+    HttpResponse apiPOST(const char* endpoint, F write_body, R read_body) {
+        ScopedLock<Mutex> lock(_mutex);
+        if (!begin_request("POST", endpoint, true)) {
+            return {-1, {}};
+        }
+        JsonWriter json(_tx_buffer + _tx_length, sizeof(_tx_buffer) - _tx_length);
+        write_body(json);
+        return read(post(endpoint, json), read_body);
+    }
+
+    template <typename F>
+    HttpResponse apiPOST(const char* endpoint, F write_body) {
+        return apiPOST(endpoint, write_body, [](const HttpResponse&) {});
+    }
+
+private:
+    /* hand a response to read_body, called with the mutex held; what is returned no
+     * longer points into _rx_buffer */
+    template <typename R>
+    static HttpResponse read(const HttpResponse& response, R& read_body) {
+        if (response.status >= 0) {
+            read_body(response);
+        }
+        return {response.status, {}};
+    }
+
+    bool initSocket();
+    bool connectSocket(SocketAddress& address);
+    void closeSocket();
+
+    /* open the connection unless the previous one is still usable */
+    bool connect();
+
+    /* send the body apiPOST() wrote after the headers */
+    HttpResponse post(const char* endpoint, const JsonWriter& json);
+
+    /* send the request built in _tx_buffer over the persistent connection, the body pointer
+     * stays valid until the next request. A connection the server already dropped is only
+     * noticed when we use it, so the request is replayed once on a fresh connection in that case */
+    HttpResponse request(const char* method, const char* endpoint);
+
+    bool resolve_hostname(SocketAddress &address);
+
+    /* write the request line and headers into _tx_buffer, leaving room for the body
+     * length when there is one. The body goes at _tx_buffer + _tx_length */
+    bool begin_request(const char* method, const char* endpoint, bool has_body);
+
+    /* account for a body of body_length bytes and fill in its Content-Length, the
+     * placeholder is padded with spaces, which HTTP allows before a header value */
+    void end_request(size_t body_length);
+
+    bool send_http_request(const char* method);
+
+    /* read a response straight into _rx_buffer, framed by Content-Length or chunked
+     * encoding so the connection can be kept open */
+    HttpResponse receive_http_response(size_t* received_bytes);
+
+#if MBED_CONF_APP_HTTP_KEEP_ALIVE
+    static constexpr bool HTTP_KEEP_ALIVE = true;
+    static constexpr const char* CONNECTION_HEADER = "keep-alive";
+#else
+    static constexpr bool HTTP_KEEP_ALIVE = false;
+    static constexpr const char* CONNECTION_HEADER = "close";
+#endif // MBED_CONF_APP_HTTP_KEEP_ALIVE
+
+    SocketType* _socket = nullptr;
+    alignas(SocketType) unsigned char _socket_storage[sizeof(SocketType)];
+#if MBED_CONF_APP_USE_TLS_SOCKET
+    mbedtls_x509_crt _cacert;
+#endif // MBED_CONF_APP_USE_TLS_SOCKET
+    NetworkInterface* _net;
+    int _timeout_ms;
+    DnsCache _dns;
+    Mutex _mutex;
+    bool _connected = false;
+    bool _keep_alive = false;
+    char _rx_buffer[MAX_MESSAGE_RECEIVED_LENGTH];
+    char _tx_buffer[MAX_MESSAGE_SENT_LENGTH];
+    size_t _tx_length = 0;
+    Callback<void(uint32_t)> _on_auth_version;
+    Callback<void(mbed::Span<const char>)> _on_search_ranges;
+};
+
+#endif
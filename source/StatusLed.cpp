@@ -0,0 +1,165 @@
+/* Status LEDs
+ */
+
+#include "StatusLed.h"
+#include "mbed.h"
+
+StatusLed::StatusLed(PinName red, PinName green, PinName blue, EventQueue *queue) :
+    _red(red), _green(green), _blue(blue),
+    _queue(queue)
+{
+}
+
+void StatusLed::show(COLOR color, LIGHT type, int num)
+{
+    _queue->call(this, &StatusLed::start, color, type, num);
+}
+
+void StatusLed::start(COLOR color, LIGHT type, int num)
+{
+    if (type == SOLID && num == 0) {
+        _base = color;
+        if (!_running) {
+            apply(_base);
+        }
+        return;
+    }
+
+    if (_pending_count == MAX_PENDING) {
+        /* drop the oldest pattern rather than lag behind */
+        for (int i = 1; i < MAX_PENDING; i++) {
+            _pending[i - 1] = _pending[i];
+        }
+        _pending_count--;
+    }
+    _pending[_pending_count++] = {color, type, num};
+
+    if (!_running) {
+        next();
+    }
+}
+
+void StatusLed::next()
+{
+    if (_pending_count == 0) {
+        _running = false;
+        apply(_base);
+        return;
+    }
+
+    _current = _pending[0];
+    for (int i = 1; i < _pending_count; i++) {
+        _pending[i - 1] = _pending[i];
+    }
+    _pending_count--;
+
+    _running = true;
+    _step = 0;
+    step();
+}
+
+void StatusLed::step()
+{
+    switch (_current.type) {
+        case SOLID:
+            if (_step++ == 0) {
+                apply(_current.color);
+                _queue->call_in(std::chrono::seconds(_current.num), this, &StatusLed::step);
+            } else {
+                next();
+            }
+            break;
+        case BLINK:
+            /* even steps on, odd steps off */
+            if (_step >= 2 * _current.num) {
+                next();
+                return;
+            }
+            if (_step++ % 2 == 0) {
+                apply(_current.color);
+            } else {
+                off();
+            }
+            _queue->call_in(std::chrono::milliseconds(BLINK_MS), this, &StatusLed::step);
+            break;
+    }
+}
+
+void StatusLed::apply(COLOR color)
+{
+    switch (color) {
+        case WHITE:
+            _red = 1; _green = 1; _blue = 1;
+            break;
+        case RED:
+            _red = 1; _green = 0; _blue = 0;
+            break;
+        case BLUE:
+            _red = 0; _green = 0; _blue = 1;
+            break;
+        case GREEN:
+            _red = 0; _green = 1; _blue = 0;
+            break;
+        case PINK:
+            _red = 1; _green = 0; _blue = 1;
+            break;
+        case YELLOW:
+            _red = 1; _green = 1; _blue = 0;
+            break;
+        case CYAN:
+            _red = 0; _green = 1; _blue = 1;
+            break;
+    }
+}
+
+void StatusLed::off()
+{
+    _red = 0;
+    _green = 0;
+    _blue = 0;
+}
+
+SensorRing::SensorRing(EventQueue *queue, Fingerprint *sensor) :
+    _queue(queue), _sensor(sensor)
+{
+}
+
+void SensorRing::set(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count)
+{
+    _queue->call(this, &SensorRing::command, control, speed, coloridx, count);
+}
+
+void SensorRing::set(bool on)
+{
+    _queue->call(this, &SensorRing::power, on);
+}
+
+void SensorRing::apply(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count)
+{
+    command(control, speed, coloridx, count);
+}
+
+void SensorRing::restore()
+{
+    _queue->call(this, &SensorRing::replay);
+}
+
+void SensorRing::command(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count)
+{
+    _ring[0] = control;
+    _ring[1] = speed;
+    _ring[2] = coloridx;
+    _ring[3] = count;
+    _sensor->LEDcontrol(control, speed, coloridx, count);
+}
+
+void SensorRing::power(bool on)
+{
+    _sensor->LEDcontrol(on);
+}
+
+void SensorRing::replay()
+{
+    _sensor->LEDcontrol(true);
+    _sensor->LEDcontrol(_ring[0], _ring[1], _ring[2], _ring[3]);
+}
@@ -0,0 +1,97 @@
+/* Status LEDs
+ *
+ * Plays the RGB status LED patterns and the sensor ring LED commands from an
+ * EventQueue, so that the caller never waits for an animation to finish. There
+ * is one RGB LED on the board and one SensorRing per sensor.
+ */
+
+#ifndef STATUS_LED_H
+#define STATUS_LED_H
+
+#include "mbed.h"
+#include "Fingerprint.h"
+
+enum COLOR {
+    WHITE = 'W',
+    RED = 'R',
+    BLUE = 'B',
+    GREEN = 'G',
+    PINK = 'P',
+    YELLOW = 'Y',
+    CYAN = 'C' // ORANGE
+};
+
+enum LIGHT {
+    BLINK = 'B',
+    SOLID = 'S'
+};
+
+class StatusLed {
+    static constexpr uint32_t BLINK_MS = 100;
+    static constexpr int MAX_PENDING = 4;
+
+public:
+    /* queue runs the RGB animation */
+    StatusLed(PinName red, PinName green, PinName blue, EventQueue *queue);
+
+    /* SOLID with num 0 sets the idle color, SOLID for num seconds and num BLINKs are
+     * played in order on top of it. Returns immediately */
+    void show(COLOR color, LIGHT type, int num);
+
+private:
+    struct Pattern {
+        COLOR color;
+        LIGHT type;
+        int num;
+    };
+
+    void start(COLOR color, LIGHT type, int num);
+    void next();
+    void step();
+    void apply(COLOR color);
+    void off();
+
+    DigitalOut _red;
+    DigitalOut _green;
+    DigitalOut _blue;
+    EventQueue *_queue;
+
+    /* only touched from _queue */
+    COLOR _base = WHITE;
+    Pattern _pending[MAX_PENDING];
+    int _pending_count = 0;
+    Pattern _current;
+    bool _running = false;
+    int _step = 0;
+};
+
+class SensorRing {
+public:
+    /* queue runs the ring LED commands, which wait for the sensor UART when another
+     * command is in progress */
+    SensorRing(EventQueue *queue, Fingerprint *sensor);
+
+    /* Fingerprint::LEDcontrol() on the sensor ring LED, returns immediately */
+    void set(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0);
+    void set(bool on);
+
+    /* set() run at once, for code that is itself running on the queue: what it posts
+     * there would only light up once that code returned */
+    void apply(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0);
+
+    /* plays the last ring LED command again, e.g. once the sensor woke up */
+    void restore();
+
+private:
+    void command(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count);
+    void power(bool on);
+    void replay();
+
+    EventQueue *_queue;
+    Fingerprint *_sensor;
+
+    /* only touched from _queue */
+    uint8_t _ring[4] = {FINGERPRINT_LED_OFF, 0, FINGERPRINT_LED_BLUE, 0};
+};
+
+#endif
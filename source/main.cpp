@@ -17,18 +17,21 @@
 #include "mbed.h"
 #include "wifi_helper.h"
 #include "mbed-trace/mbed_trace.h"
+#include "LogSink.h"
 #include <Fingerprint.h>
-#include <utility>
-#include <string>
+#include "Keypad.h"
+#include "StatusLed.h"
+#include "SignInJournal.h"
+#include "AuthCache.h"
+#include "FlashIAPBlockDevice.h"
+#include "SocketDemo.h"
+#include "JsonWriter.h"
+#include "Metrics.h"
+#include "IdleManager.h"
 #include <cstdio>
+#include <atomic>
 
-#if MBED_CONF_APP_USE_TLS_SOCKET
-#include "root_ca_cert.h"
-
-#ifndef DEVICE_TRNG
-#error "mbed-os-example-tls-socket requires a device which supports TRNG"
-#endif
-#endif // MBED_CONF_APP_USE_TLS_SOCKET
+#define TRACE_GROUP "MAIN"
 
 
 ///////////////////////////
@@ -37,14 +40,22 @@
 
 class Net {
     static constexpr size_t MAX_NUMBER_OF_ACCESS_POINTS = 10;
+    static constexpr uint32_t CONNECTED_FLAG = 1;
+    static constexpr uint32_t RECONNECT_DELAY_MS = 2000;
+    /* the TLS handshake of a pre-connect runs on this thread too */
+    static constexpr uint32_t THREAD_STACK_SIZE = MBED_CONF_APP_NET_THREAD_STACK_SIZE;
 public:
-    Net() : _net(NetworkInterface::get_default_instance())
+    static constexpr uint32_t CONNECT_TIMEOUT_MS = 10000;
+
+    Net() : _net(NetworkInterface::get_default_instance()),
+            _thread(osPriorityBelowNormal, THREAD_STACK_SIZE, nullptr, "net")
     {
     }
 
     ~Net()
     {
         if (_net) {
+            _stopping = true;
             _net->disconnect();
         }
     }
@@ -53,34 +64,43 @@ public:
         return _net;
     }
 
-    void preinit()
+    /* queue serviced by the network thread, for anything that may block on the link */
+    EventQueue* get_queue() {
+        return &_queue;
+    }
+
+    /* start the connection manager: the link is brought up once in the background and
+     * only re-established when the interface reports that it dropped */
+    void init()
     {
         if (!_net) {
-            printf("Error! No network interface found.\r\n");
+            tr_error("Error! No network interface found.");
             return;
         }
 
-        /* if we're using a wifi interface run a quick scan */
-        if (_net->wifiInterface()) {
-            /* the scan is not required to connect and only serves to show visible access points */
-            wifi_scan();
+        _net->attach(callback(this, &Net::status_changed));
+        _thread.start(callback(&_queue, &EventQueue::dispatch_forever));
 
-            /* in this example we use credentials configured at compile time which are used by
-             * NetworkInterface::connect() but it's possible to do this at runtime by using the
-             * WiFiInterface::connect() which takes these parameters as arguments */
+#if MBED_CONF_APP_WIFI_SCAN
+        /* the scan is not required to connect and only serves to show visible access points */
+        if (_net->wifiInterface()) {
+            _queue.call(this, &Net::wifi_scan);
         }
+#endif // MBED_CONF_APP_WIFI_SCAN
 
-        /* connect will perform the action appropriate to the interface type to connect to the network */
-
-        printf("Connecting to the network...\r\n");
+        schedule_connect(0ms);
+    }
 
-        nsapi_size_or_error_t result = _net->connect();
-        if (result != 0) {
-            printf("Error! _net->connect() returned: %d\r\n", result);
-            return;
-        }
+    bool is_connected()
+    {
+        return _flags.get() & CONNECTED_FLAG;
+    }
 
-        print_network_info();
+    /* block until the link is up, returns false if it did not come up in time */
+    bool wait_connected(Kernel::Clock::duration timeout = std::chrono::milliseconds(CONNECT_TIMEOUT_MS))
+    {
+        uint32_t flags = _flags.wait_any_for(CONNECTED_FLAG, timeout, false);
+        return !(flags & osFlagsError);
     }
 
     void wifi_scan()
@@ -93,20 +113,36 @@ public:
         int result = wifi->scan(ap, MAX_NUMBER_OF_ACCESS_POINTS);
 
         if (result <= 0) {
-            printf("WiFiInterface::scan() failed with return value: %d\r\n", result);
+            tr_error("WiFiInterface::scan() failed with return value: %d", result);
             return;
         }
 
-        printf("%d networks available:\r\n", result);
+        tr_info("%d networks available:", result);
 
         for (int i = 0; i < result; i++) {
-            printf("Network: %s secured: %s BSSID: %hhX:%hhX:%hhX:%hhx:%hhx:%hhx RSSI: %hhd Ch: %hhd\r\n",
+            tr_info("Network: %s secured: %s BSSID: %hhX:%hhX:%hhX:%hhx:%hhx:%hhx RSSI: %hhd Ch: %hhd",
                    ap[i].get_ssid(), get_security_string(ap[i].get_security()),
                    ap[i].get_bssid()[0], ap[i].get_bssid()[1], ap[i].get_bssid()[2],
                    ap[i].get_bssid()[3], ap[i].get_bssid()[4], ap[i].get_bssid()[5],
                    ap[i].get_rssi(), ap[i].get_channel());
         }
-        printf("\r\n");
+    }
+
+    /* take the link down while idle, nothing reconnects it until resume() */
+    void suspend()
+    {
+        if (!_net || _suspended.exchange(true)) {
+            return;
+        }
+        _queue.call(this, &Net::disconnect);
+    }
+
+    void resume()
+    {
+        if (!_net || !_suspended.exchange(false)) {
+            return;
+        }
+        schedule_connect(0ms);
     }
 
     void print_network_info()
@@ -114,661 +150,298 @@ public:
         /* print the network info */
         SocketAddress a;
         _net->get_ip_address(&a);
-        printf("IP address: %s\r\n", a.get_ip_address() ? a.get_ip_address() : "None");
+        tr_info("IP address: %s", a.get_ip_address() ? a.get_ip_address() : "None");
         _net->get_netmask(&a);
-        printf("Netmask: %s\r\n", a.get_ip_address() ? a.get_ip_address() : "None");
+        tr_info("Netmask: %s", a.get_ip_address() ? a.get_ip_address() : "None");
         _net->get_gateway(&a);
-        printf("Gateway: %s\r\n", a.get_ip_address() ? a.get_ip_address() : "None");
+        tr_info("Gateway: %s", a.get_ip_address() ? a.get_ip_address() : "None");
     }
 private:
-    NetworkInterface *_net;
-};
-
-
-///////////////////////////
-//////   SOCKETS   ////////
-///////////////////////////
-
-
-class SocketDemo {
-    static constexpr size_t MAX_MESSAGE_RECEIVED_LENGTH = 1000;
-
-#if MBED_CONF_APP_USE_TLS_SOCKET
-    static constexpr size_t REMOTE_PORT = 443; // tls port
-#else
-    static constexpr size_t REMOTE_PORT = 80; // standard HTTP port
-#endif // MBED_CONF_APP_USE_TLS_SOCKET
-
-public:
-    SocketDemo(NetworkInterface* net) : _net(net)
-    {
-    }
-
-    ~SocketDemo()
+    void schedule_connect(Kernel::Clock::duration delay)
     {
-        if (_net) {
-            _net->disconnect();
-        }
-    }
-
-    void initSocket() {
-#if MBED_CONF_APP_USE_TLS_SOCKET
-        nsapi_size_or_error_t result = _socket.set_root_ca_cert(root_ca_cert);
-        if (result != NSAPI_ERROR_OK) {
-            printf("Error: _socket.set_root_ca_cert() returned %d\n", result);
-            return;
-        }
-        _socket.set_hostname(MBED_CONF_APP_HOSTNAME);
-#endif // MBED_CONF_APP_USE_TLS_SOCKET
-
-        /* opening the socket only allocates resources */
-        result = _socket.open(_net);
-        if (result != 0) {
-            printf("Error! _socket.open() returned: %d\r\n", result);
+        if (_connect_pending.exchange(true)) {
             return;
         }
+        _queue.call_in(delay, this, &Net::connect);
     }
 
-    void connectSocket(SocketAddress& address) {
-        /* we are connected to the network but since we're using a connection oriented
-        * protocol we still need to open a connection on the socket */
-        printf("Opening connection to remote port %d\r\n", REMOTE_PORT);
-        nsapi_size_or_error_t result = _socket.connect(address);
-        if (result != 0) {
-            printf("Error! _socket.connect() returned: %d\r\n", result);
+    void connect()
+    {
+        _connect_pending = false;
+        if (_stopping || _suspended || is_connected()) {
             return;
         }
-    }
 
-    void closeSocket() {
-        _socket.set_timeout(0); // Force TLS connection reset
-        _socket.close();
-        // ThisThread::sleep_for(100ms);
-    }
+        /* in this example we use credentials configured at compile time which are used by
+         * NetworkInterface::connect() but it's possible to do this at runtime by using the
+         * WiFiInterface::connect() which takes these parameters as arguments */
+        tr_info("Connecting to the network...");
 
-    void apiPing() {
-        initSocket();
-        SocketAddress address;
-        if (!resolve_hostname(address)) {
-            closeSocket();
-            return;
-        }
-        address.set_port(REMOTE_PORT);
-        connectSocket(address);
-
-        if (!send_http_ping_request()) {
-            closeSocket();
+        nsapi_size_or_error_t result = _net->connect();
+        if (result == NSAPI_ERROR_IS_CONNECTED) {
+            _flags.set(CONNECTED_FLAG);
             return;
         }
-
-        if (!receive_http_ping_response()) {
-            closeSocket();
+        if (result != 0) {
+            tr_error("Error! _net->connect() returned: %d, retrying", result);
+            schedule_connect(std::chrono::milliseconds(RECONNECT_DELAY_MS));
             return;
         }
 
-        closeSocket();
-    }
-
-    std::pair<int, char*> apiPOST(const char* endpoint, const char* json_data) {
-        initSocket();
-        SocketAddress address;
-
-        if (!resolve_hostname(address)) {
-            closeSocket();
-            return {-1, nullptr}; 
-        }
-        
-        address.set_port(REMOTE_PORT);
-        connectSocket(address);
-        printf("Sending HTTP POST Request to %s...\r\n", endpoint);
-        if (!send_http_post_request(endpoint, json_data)) {
-            closeSocket();
-            return {-1, nullptr};  // Return an error code (-1) and an empty string if the POST request fails
-        }
-
-        printf("Waiting for HTTP POST Response...\r\n");
-        std::pair<int, char*> response = receive_http_post_response();
-        int status_code = response.first;
-        char* raw_response = response.second;
-
-        if (status_code < 0 || !raw_response) {
-            closeSocket();
-            return {status_code, nullptr};  // Return the status code and an empty string if the response is invalid
-        }
-
-        closeSocket();
-        return {status_code, raw_response};  // Return the status code and the response body as a pair
+        /* not every driver reports the status change, so don't wait for it */
+        _flags.set(CONNECTED_FLAG);
+        print_network_info();
     }
 
-private:
-    bool resolve_hostname(SocketAddress &address)
+    void disconnect()
     {
-        const char hostname[] = MBED_CONF_APP_HOSTNAME;
-
-        /* get the host address */
-        printf("\nResolve hostname %s\r\n", hostname);
-        nsapi_size_or_error_t result = _net->gethostbyname(hostname, &address);
-        if (result != 0) {
-            printf("Error! gethostbyname(%s) returned: %d\r\n", hostname, result);
-            return false;
-        }
-
-        printf("%s address is %s\r\n", hostname, (address.get_ip_address() ? address.get_ip_address() : "None") );
-
-        return true;
+        _flags.clear(CONNECTED_FLAG);
+        _net->disconnect();
+        tr_info("Network suspended");
     }
 
-    bool send_http_ping_request()
+    /* called by the interface, possibly from its own thread: only touch the flags and the queue */
+    void status_changed(nsapi_event_t event, intptr_t value)
     {
-        /* loop until whole request sent */
-        const char buffer[] = "GET /api/ping HTTP/1.1\r\n"
-                              "Host: iot-auth-project.rezo-rm.fr\r\n"
-                              "Connection: close\r\n"
-                              "\r\n";
-
-        nsapi_size_t bytes_to_send = strlen(buffer);
-        nsapi_size_or_error_t bytes_sent = 0;
-
-        printf("\r\nSending message: \r\n%s", buffer);
-
-        while (bytes_to_send) {
-            bytes_sent = _socket.send(buffer + bytes_sent, bytes_to_send);
-            if (bytes_sent < 0) {
-                printf("Error! _socket.send() returned: %d\r\n", bytes_sent);
-                return false;
-            } else {
-                printf("sent %d bytes\r\n", bytes_sent);
-            }
-
-            bytes_to_send -= bytes_sent;
+        if (event != NSAPI_EVENT_CONNECTION_STATUS_CHANGE) {
+            return;
         }
 
-        printf("Complete message sent\r\n");
-
-        return true;
+        switch (value) {
+            case NSAPI_STATUS_LOCAL_UP:
+            case NSAPI_STATUS_GLOBAL_UP:
+                _flags.set(CONNECTED_FLAG);
+                break;
+            case NSAPI_STATUS_DISCONNECTED:
+                _flags.clear(CONNECTED_FLAG);
+                if (!_stopping && !_suspended) {
+                    schedule_connect(std::chrono::milliseconds(RECONNECT_DELAY_MS));
+                }
+                break;
+            default:
+                break;
+        }
     }
 
-    bool receive_http_ping_response() {
-        char buffer[MAX_MESSAGE_RECEIVED_LENGTH];
-        int remaining_bytes = MAX_MESSAGE_RECEIVED_LENGTH;
-        int received_bytes = 0;
+    NetworkInterface *_net;
+    Thread _thread;
+    EventQueue _queue;
+    EventFlags _flags;
+    std::atomic<bool> _connect_pending{false};
+    std::atomic<bool> _stopping{false};
+    std::atomic<bool> _suspended{false};
+};
 
-        /* Loop until there is nothing received or we've run out of buffer space */
-        nsapi_size_or_error_t result = remaining_bytes;
-        while (result > 0 && remaining_bytes > 0) {
-            result = _socket.recv(buffer + received_bytes, remaining_bytes);
-            if (result < 0) {
-                printf("Error! _socket.recv() returned: %d\r\n", result);
-                return false;
-            }
 
-            received_bytes += result;
-            remaining_bytes -= result;
-        }
+//////////////////////////////
+//////     EVENTS     ////////
+//////////////////////////////
 
-        /* Null-terminate the received data to safely work with it as a string */
-        if (received_bytes < MAX_MESSAGE_RECEIVED_LENGTH) {
-            buffer[received_bytes] = '\0';
-        } else {
-            buffer[MAX_MESSAGE_RECEIVED_LENGTH - 1] = '\0';
-        }
+// Tout ce que main() attend (touche, doigt) arrive par cette boite aux lettres
+enum AppEventType {
+    KEY_EVENT,
+    FINGER_EVENT
+};
 
-        /* Find the start of the JSON payload by looking for the end of the headers */
-        char *json_start = strstr(buffer, "\r\n\r\n");
-        if (json_start) {
-            json_start += 4; // Move past the "\r\n\r\n" to the start of the JSON body
+struct AppEvent {
+    AppEventType type;
+    char key;
+    uint8_t door; // lecteur qui a vu le doigt
+};
 
-            printf("Received JSON response:\r\n%s\r\n", json_start);
+Mail<AppEvent, 16> app_events;
 
-            // Optional: If you want to check the JSON content
-            if (strstr(json_start, "\"message\":\"pong\"")) {
-                printf("JSON contains message: pong\r\n");
-            }
-        } else {
-            printf("Error: No JSON payload found.\r\n");
-            printf("Full response:\r\n%s\r\n", buffer);  // Debug: print the full response for inspection
-            return false;
-        }
+// Veille apres idle-timeout ms sans evenement, les evenements en sont les reveils
+IdleManager idle_manager(MBED_CONF_APP_IDLE_TIMEOUT_MS, MBED_CONF_APP_IDLE_WAKE_BUDGET_MS);
 
-        return true;
+// utilisable depuis une IT
+void post_event(AppEventType type, char key = '\0', uint8_t door = 0)
+{
+    idle_manager.event();
+    AppEvent *event = app_events.try_alloc();
+    if (event) {
+        event->type = type;
+        event->key = key;
+        event->door = door;
+        app_events.put(event);
     }
+}
 
-    bool send_http_post_request(const char* endpoint, const char* json_data)
-    {
-        // Construct the HTTP POST request with the JSON data
-        char buffer[1024];
-        snprintf(buffer, sizeof(buffer),
-                "POST %s HTTP/1.1\r\n"
-                "Host: iot-auth-project.rezo-rm.fr\r\n"
-                "Content-Type: application/json\r\n"
-                "Content-Length: %zu\r\n"
-                "Connection: close\r\n"
-                "\r\n"
-                "%s", 
-                endpoint, strlen(json_data), json_data);
-                
-        nsapi_size_t bytes_to_send = strlen(buffer);
-        nsapi_size_or_error_t bytes_sent = 0;
-
-        printf("\r\nSending POST request:\r\n%s", buffer);
-
-        while (bytes_to_send) {
-            bytes_sent = _socket.send(buffer + bytes_sent, bytes_to_send);
-            if (bytes_sent < 0) {
-                printf("Error! _socket.send() returned: %d\r\n", bytes_sent);
-                return false;
-            } else {
-                printf("Sent %d bytes\r\n", bytes_sent);
-            }
-
-            bytes_to_send -= bytes_sent;
-        }
-
-        printf("Complete POST request sent\r\n");
-
-        return true;
+AppEvent wait_event()
+{
+    AppEvent *mail = app_events.try_get_for(idle_manager.timeout());
+    while (mail == nullptr) {
+        idle_manager.idle();
+        mail = app_events.try_get_for(idle_manager.timeout());
     }
+    idle_manager.active();
+    AppEvent event = *mail;
+    app_events.free(mail);
+    return event;
+}
 
-    std::pair<int, char*> receive_http_post_response() {
-        char buffer[MAX_MESSAGE_RECEIVED_LENGTH];
-        int remaining_bytes = MAX_MESSAGE_RECEIVED_LENGTH;
-        int received_bytes = 0;
-        nsapi_size_or_error_t result = remaining_bytes;
-        while (result > 0 && remaining_bytes > 0) {
-            result = _socket.recv(buffer + received_bytes, remaining_bytes);
-            if (result < 0) {
-                printf("Error! _socket.recv() returned: %d\r\n", result);
-                return std::make_pair(-1, nullptr);
-            }
-            received_bytes += result;
-            remaining_bytes -= result;
-        }
-
-        // Null-terminate the received data to safely work with it as a string
-        if (received_bytes < MAX_MESSAGE_RECEIVED_LENGTH) {
-            buffer[received_bytes] = '\0';
-        } else {
-            buffer[MAX_MESSAGE_RECEIVED_LENGTH - 1] = '\0';
-        }
-
-        char* cloneBuffer = new char[strlen(buffer) + 1]; // Allocate memory for the clone
-        std::strcpy(cloneBuffer, buffer); // Copy the content
-
-        // Parse the HTTP response status code
-        int status_code = -1;
-        char* status_line = strtok(buffer, "\r\n");
-        if (status_line) {
-            char* token = strtok(status_line, " ");
-            token = strtok(nullptr, " ");
-            if (token) {
-                status_code = atoi(token);
-            }
-        }
-
-        // Find the start of the JSON payload by looking for the end of the headers
-        char* json_start = strstr(cloneBuffer, "\r\n\r\n");
-        if (json_start) {
-            json_start += 4; // Move past the "\r\n\r\n" to the start of the JSON body
-            printf("Received JSON response:\r\n%s\r\n", json_start);
-            return std::make_pair(status_code, json_start);
-        } else {
-            printf("Error: No JSON payload found.\r\n");
-            printf("Full response:\r\n%s\r\n", cloneBuffer); // Debug: print the full response for inspection
-            return std::make_pair(status_code, nullptr);
-        }
-    }
+// file d'evenements de l'interface (clavier, LED de statut), servie par son propre thread
+EventQueue ui_queue;
+Thread ui_thread(osPriorityAboveNormal, MBED_CONF_APP_UI_THREAD_STACK_SIZE, nullptr, "ui");
 
-#if MBED_CONF_APP_USE_TLS_SOCKET
-    TLSSocket _socket;
-#else
-    TCPSocket _socket;
-#endif // MBED_CONF_APP_USE_TLS_SOCKET
-    NetworkInterface* _net;
-};
 
 //////////////////////////////
 //////    KEYBOARD    ////////
 //////////////////////////////
 
 
-// Définition des broches
-BusOut columns(D7, D6, D5, D4);  // Colonnes du clavier 4x4
-BusIn rows(D11, D10, D9, D8);    // Lignes du clavier 4x4
-
-
-// PIN led clavier (anti doublon) (y4 correspond au pin le plus à droite lorsque l'on regarde le clivier de face)
-DigitalOut led_clavier(LED1);
-
-// PINS clavier
-DigitalIn y4(D11);
-DigitalIn y3(D10);
-DigitalIn y2(D9);
-DigitalIn y1(D8);
-
-DigitalOut x4(D7);
-DigitalOut x3(D6);
-DigitalOut x2(D5);
-DigitalOut x1(D4);
-
-/*
-DigitalIn y4(D4);
-DigitalIn y3(D5);
-DigitalIn y2(D6);
-DigitalIn y1(D7);
-
-DigitalOut x4(D8);
-DigitalOut x3(D9);
-DigitalOut x2(D10);
-DigitalOut x1(D11);
-*/
-
-DigitalIn lignes_in[] = {y1,y2,y3,y4};
-DigitalOut colones_out[] = {x1,x2,x3,x4};
-
 // Tableau des touches correspondant au clavier EOZ 4x4
-char keys[4][4] = {
+const char keys[4][4] = {
     {'1', '2', '3', 'F'},
     {'4', '5', '6', 'E'},
     {'7', '8', '9', 'D'},
     {'A', '0', 'B', 'C'}
 };
 
-void scan_keypad()
+void keyPressed(char key)
 {
-
-    for (int col = 0; col < 4; col++) {
-        // Active une colonne à la fois
-        columns = ~(1 << col); // Met la colonne courante à 0 et les autres à 1
-
-        // Lecture des lignes
-        for (int row = 0; row < 4; row++) {
-            if (!(rows.read() & (1 << row))) { // Si la ligne est active (état bas)
-                ThisThread::sleep_for(50ms);
-                printf("Key pressed: %c\n\r", keys[row][col]);
-                while (!(rows.read() & (1 << row))) {
-                    // Attente que la touche soit relâchée
-                }
-                break;
-            }
-        }
-    }
+    post_event(KEY_EVENT, key);
 }
 
+// lignes (y1..y4) puis colonnes (x1..x4), y4 correspond au pin le plus à droite
+// lorsque l'on regarde le clavier de face
+Keypad keypad(D8, D9, D10, D11, D4, D5, D6, D7, keys, &ui_queue, callback(keyPressed));
 
-char scan_keypad_mine()
-{
-    int counter = 0;
-    int last_col = -1;
-    int last_row = -1;
-    // on active une à une chaque colone
-    for (int col = 0; col < 4; col++) {
-        colones_out[col] = 0;
-        //ThisThread::sleep_for(1000ms);
-        // pour chaque ligne on regarde la valeur de la pin
-        for (int row = 0; row < 4; row++) {
-            // si la pin est active alors 
-            //printf("%d", lignes_in[row].read() ? 0 : 1);
-            if(!lignes_in[row].read()){
-                counter +=1;
-                last_col = col;
-                last_row = row;
-            }
-            /*
-            if (!lignes_in[row].read()) {
-                ThisThread::sleep_for(50ms);
-                // on affiche le caractère pressé
-                printf("Key pressed: %c\n\r", keys[row][col]);
-                // et on attend qu'il soit relaché
-            }
-            */
+// attend l'appui d'une touche, les detections de doigt entre temps sont ignorees
+char wait_falling_edge() {
+    while (true) {
+        AppEvent event = wait_event();
+        if (event.type == KEY_EVENT) {
+            return event.key;
         }
-        colones_out[col] = 1;
-        //printf("\n");
-    }
-    //printf("\ncounter = %d\n", counter);
-    //printf("\n");
-    if (counter == 1){
-        printf("Key pressed: %c\n\r", keys[last_row][last_col]);
-        return keys[last_row][last_col];
     }
-    return '\0';
 }
 
-char scan_keypad_mine_clean()
-{
-    // on s'assure que les pins soit initialement en état haut
-    for (int i = 0; i < 4; i++) {colones_out[i] = 1;}
-
-    // on initialise les variable d'états
-    int counter = 0; // nombre de bouton lu comme activé
-    int last_col = -1; // position en colone du dernier bouton activé lu
-    int last_row = -1; // position en ligne du dernier bouton activé lu
-
-    // on désactive une à une chaque colone
-    for (int col = 0; col < 4; col++) {
-        colones_out[col] = 0;
-
-        // pour chaque ligne on regarde la valeur des pins d'entré
-        for (int row = 0; row < 4; row++) {
-            // si la pin est désactive alors c'est que le bouton à été appuié
-            if(!lignes_in[row].read()){
-                // on change les variables d'état en fonction de la position de la pin
-                counter +=1;
-                last_col = col;
-                last_row = row;
+
+int reset = 0;
+
+char wait_choice_key_falling(const char charsa[], size_t charsa_len){
+    while (true) {
+        char waited_key = wait_falling_edge();
+        for (size_t i = 0; i < charsa_len; i ++) {
+            if (waited_key == charsa[i]) {
+                return waited_key;
             }
         }
-        // on re-active la colone avant de passer à la suivante
-        colones_out[col] = 1; 
     }
-    // si le compteur à bien la valeur 1, alors on a qu'un seul bouton de pressé 
-    if (counter == 1){
-        return keys[last_row][last_col];
-    }
-    // TODO : gérer le cas où counter est supérieur à 1
-    return '\0';
 }
 
-char scan_falling_char() {
-    led_clavier = 0;
-    char pressed = scan_keypad_mine_clean();
-    if (pressed == '\0') {
-        //rien n'a été pressé
-    } else {
-        while (scan_keypad_mine_clean() == pressed) {}
-        //printf("Key pressed: %c\n\r", pressed);
-    }
-    return pressed;
-}
+const char INIT_KEYS[] = {'A','B','D'};
 
-void wait_for_key(char cara) {
-    while (scan_keypad_mine_clean() != cara) {}
-}
 
-char wait_rising_edge() {
-    char pressed = '\0';
-    while (pressed == '\0') {pressed = scan_keypad_mine_clean();}
-    return pressed;
-}
 
-char wait_falling_edge() {
-    char pressed1 = '\0';
-    while (pressed1 == '\0') {pressed1 = scan_keypad_mine_clean();}
-    while (scan_keypad_mine_clean() == pressed1) {}
-    return pressed1;
-}
+//////////////////////////////
+//////   FINGERPINT   ////////
+//////////////////////////////
 
-void wait_rising_edge_char(char car) {
-    while (scan_keypad_mine_clean() != car) {}
-}
+DigitalOut ledV(LED1); // for various information without terminal
 
-void wait_falling_edge_char(char car) {
-    while (scan_keypad_mine_clean() != car) {}
-    while (scan_keypad_mine_clean() == car) {}
-}
+// LED RGB de statut, animee sans bloquer l'appelant
+StatusLed status_led(D1, D2, D3, &ui_queue);
 
-int main_clavier()
-{
-    printf("Starting keypadmine scanning\n\r");
-    /*
-    for (int i = 0; i < 4; i++) {colones_out[i] = 0;}
-    ThisThread::sleep_for(1000ms);  // Petite pause pour éviter les rebonds
-    for (int i = 0; i < 4; i++) {colones_out[i] = 1;}
-    */
-    while (true) {
-        //scan_keypad_mine();                // Balayage du clavier
-        scan_falling_char();
-        ThisThread::sleep_for(100ms);  // Petite pause pour éviter les rebonds
-    }
+void led(enum COLOR color, enum LIGHT type, int num) {
+    tr_debug("led = %c | type = %c | num = %d", color, type, num);
+    status_led.show(color, type, num);
 }
 
+class JournalUploader;
 
-enum COLOR {
-    WHITE = 'W',
-    RED = 'R',
-    BLUE = 'B',
-    GREEN = 'G',
-    PINK = 'P',
-    YELLOW = 'Y',
-    CYAN = 'C' // ORANGE
-};
-
-enum LIGHT {
-    BLINK = 'B',
-    SOLID = 'S'
-};
+// Un lecteur par porte : le capteur, son anneau LED et le thread qui lui parle.
+// Chaque lecteur verifie ses doigts sur son thread, ceux d'une double porte
+// travaillent donc en parallele et partagent la connexion au serveur et le journal
+class Door {
+public:
+    Door(uint8_t index, const char* name, PinName tx, PinName rx, PinName wakeup) :
+        sensor(tx, rx, 0x0, wakeup),
+        ring(&_queue, &sensor),
+        _index(index),
+        _thread(osPriorityNormal, MBED_CONF_APP_DOOR_THREAD_STACK_SIZE, nullptr, name)
+    {
+    }
 
-#define TIMING_BLINK_KED 100ms
-
-DigitalOut led_red(D1);
-DigitalOut led_green(D2);
-DigitalOut led_blue(D3);
-
-//void led(enum COLOR color, enum LIGHT type, int num) { printf("led = %c | type = %c | num = %d\n", color, type, num);}
-void led(enum COLOR color, enum LIGHT type, int num) { 
-    printf("led = %c | type = %c | num = %d\n", color, type, num);
-    int led_color[3] = {};
-    switch (color) {
-        case WHITE:
-            led_color[0] = 1;
-            led_color[1] = 1;
-            led_color[2] = 1;
-            break;
-        case RED:
-            led_color[0] = 1;
-            led_color[1] = 0;
-            led_color[2] = 0;
-            break;
-        case BLUE:
-            led_color[0] = 0;
-            led_color[1] = 0;
-            led_color[2] = 1;
-            break;
-        case GREEN:
-            led_color[0] = 0;
-            led_color[1] = 1;
-            led_color[2] = 0;
-            break;
-        case PINK:
-            led_color[0] = 1;
-            led_color[1] = 0;
-            led_color[2] = 1;
-            break;
-        case YELLOW:
-            led_color[0] = 1;
-            led_color[1] = 1;
-            led_color[2] = 0;
-            break;
-        case CYAN:
-            led_color[0] = 0;
-            led_color[1] = 1;
-            led_color[2] = 1;
-            break;
+    uint8_t index() const {
+        return _index;
     }
-    switch (type) {
-        case BLINK:
-            for (int i = 0; i < num; i ++) {
-                led_red = led_color[0];
-                led_green = led_color[1];
-                led_blue = led_color[2];
-                ThisThread::sleep_for(TIMING_BLINK_KED);
-                led_red = 0;
-                led_green = 0;
-                led_blue = 0;
-                ThisThread::sleep_for(TIMING_BLINK_KED);
-            }
-            break;
-        case SOLID:
-            led_red = led_color[0];
-            led_green = led_color[1];
-            led_blue = led_color[2];
-            ThisThread::sleep_for(num * 1000ms);
-            break;
+
+    /* thread of this reader, its finger detections are posted as FINGER_EVENTs */
+    void start() {
+        _thread.start(callback(&_queue, &EventQueue::dispatch_forever));
+        sensor.attachDetect(callback(this, &Door::detected));
+        sensor.enableDetect(true);
     }
-}
 
-int reset = 0;
+    /* server connection and upload queue, shared by every door */
+    void attach(Net* net, SocketDemo* sckt, JournalUploader* uploader) {
+        _net = net;
+        _sckt = sckt;
+        _uploader = uploader;
+    }
 
-char wait_choice_key_falling(const char charsa[], size_t charsa_len){
-    char waited_key = '\0';
-    bool done = false;
-    while(!done) {
-        waited_key = wait_falling_edge();
-        for( int i = 0 ; i < charsa_len; i ++){
-            if (waited_key == charsa[i]) {
-                done = true;
-                break;
-            }
+    /* a finger was detected in sign-in mode: check it on this reader's thread. The
+     * detections that come in meanwhile are the same finger bouncing, they are dropped */
+    void sign_in() {
+        if (!_busy.exchange(true)) {
+            _queue.call(this, &Door::check);
         }
     }
-    return waited_key;
-}
-
-const char INIT_KEYS[] = {'A','B'};
 
+    Fingerprint sensor;
+    SensorRing ring;
 
+private:
+    void detected() {
+        post_event(FINGER_EVENT, '\0', _index);
+    }
 
-//////////////////////////////
-//////   FINGERPINT   ////////
-//////////////////////////////
+    void check() {
+        verify();
+        _busy = false;
+    }
 
-DigitalOut ledV(LED1); // for various information without terminal
+    void verify();
 
-Fingerprint finger(PC_1,PC_0,0x0); // TX,TX,pass
-InterruptIn fD(PB_0);               // IT from fingerprint detection (see datasheet WAKEUP)
+    const uint8_t _index;
+    EventQueue _queue;
+    Thread _thread;
+    std::atomic<bool> _busy{false};
+    Net* _net = nullptr;
+    SocketDemo* _sckt = nullptr;
+    JournalUploader* _uploader = nullptr;
+};
 
-uint8_t id=1;
+// TX, RX, WAKEUP (IT de detection du doigt, voir la datasheet)
+Door door0(0, "door0", PC_1, PC_0, PB_0);
+#if MBED_CONF_APP_SECOND_DOOR
+Door door1(1, "door1", MBED_CONF_APP_SECOND_DOOR_TX, MBED_CONF_APP_SECOND_DOOR_RX, MBED_CONF_APP_SECOND_DOOR_WAKEUP);
+Door* const doors[] = {&door0, &door1};
+#else
+Door* const doors[] = {&door0};
+#endif // MBED_CONF_APP_SECOND_DOOR
 
-bool fingerON=false;
 
 DigitalIn btnBleu(PC_13);     // to start enroll (USER_BUTTON)
 
 
 
-// interrupt funtion 
-void fingerDetect(void)
-{
-    // ledV=1;
-    // ThisThread::sleep_for(100ms); 
-    // ledV=0;
-    fingerON=true;
-}
-
-
-
 // original setup fonction on Arduino
-void setup()
+void setup(Door* door)
 {
-    fD.fall(&fingerDetect);
-    printf("\nR503 Finger detect test\nSTM32 version with MBED compiler and library\n");
+    Fingerprint& finger = door->sensor;
+    tr_info("R503 Finger detect test, door %d", door->index());
+    tr_info("STM32 version with MBED compiler and library");
 
-    // set the data rate for the sensor serial port
-    finger.begin(57600);
+    // set the data rate for the sensor serial port, it keeps the one we set last time
     ThisThread::sleep_for(200ms);
-    if (finger.verifyPassword()) {
-        printf("\nFound fingerprint sensor!\n");
+    uint32_t baud = finger.autoBaud(MBED_CONF_APP_FINGERPRINT_BAUD_RATE);
+    if (baud) {
+        tr_info("Found fingerprint sensor at %lu baud!", (unsigned long)baud);
     } else {
-        printf("\nDid not find fingerprint sensor -> STOP !!!!\n");
+        tr_error("Did not find fingerprint sensor -> STOP !!!!");
         while (1)
         {
             ledV=1;
@@ -778,113 +451,143 @@ void setup()
         }
     }
 
-    printf("Reading sensor parameters\n");
+    tr_info("Reading sensor parameters");
     finger.getParameters();
-    printf("Status: 0x%X\n",finger.status_reg);
-    printf("Sys ID: 0x%X\n",finger.system_id);
-    printf("Capacity: %d\n",finger.capacity);
-    printf("Security level: %d\n",finger.security_level);
-    printf("Device address: 0x%X\n",finger.device_addr);
-    printf("Packet len: %d\n",finger.packet_len);
-    printf("Baud rate: %d\n",finger.baud_rate);
 
-    finger.getTemplateCount();
+    // faster link for ACKs and template transfers, back to the previous rate if it fails
+    if (finger.baud_rate != MBED_CONF_APP_FINGERPRINT_BAUD_RATE) {
+        if (finger.setBaudRate(MBED_CONF_APP_FINGERPRINT_BAUD_RATE)) {
+            tr_info("Sensor switched to %d baud", MBED_CONF_APP_FINGERPRINT_BAUD_RATE);
+        } else {
+            tr_warn("Sensor stays at %lu baud", (unsigned long)finger.baud_rate);
+        }
+    }
+    if (finger.packet_len != MBED_CONF_APP_FINGERPRINT_PACKET_SIZE
+            && finger.setPacketSize(MBED_CONF_APP_FINGERPRINT_PACKET_SIZE) != FINGERPRINT_OK) {
+        tr_warn("Could not set packet size to %d", MBED_CONF_APP_FINGERPRINT_PACKET_SIZE);
+    }
+    tr_info("Status: 0x%X",finger.status_reg);
+    tr_info("Sys ID: 0x%X",finger.system_id);
+    tr_info("Capacity: %d",finger.capacity);
+    tr_info("Security level: %d",finger.security_level);
+    tr_info("Device address: 0x%X",finger.device_addr);
+    tr_info("Packet len: %d",finger.packet_len);
+    tr_info("Baud rate: %lu",(unsigned long)finger.baud_rate);
+
+    // table d'occupation en quelques paquets, le nombre de modeles seul sinon
+    if (finger.readIndexTable() != FINGERPRINT_OK) {
+        tr_warn("Could not read the template index table");
+        finger.getTemplateCount();
+    }
 
     if (finger.templateCount == 0) {
-        printf("Sensor doesn't contain any fingerprint data. Please run the 'enroll' example.\n");
+        tr_info("Sensor doesn't contain any fingerprint data. Please run the 'enroll' example.");
     }
     else {
-        printf("Waiting for valid finger...\n");
-        printf("Sensor contains : %d templates\n",finger.templateCount);
+        tr_info("Waiting for valid finger...");
+        tr_info("Sensor contains : %d templates",finger.templateCount);
     }
 
 }
 
 // --------------------------------------
-uint8_t getFingerprintID() {
-    uint8_t p = finger.getImage();
+// returns -1 if failed, otherwise returns ID #
+int getFingerprintID(Fingerprint& finger) {
+    // capture and search back to back, the console only once it is done
+    uint8_t p = finger.identify();
     switch (p) {
         case FINGERPRINT_OK:
-            printf("Image taken\n");
             break;
         case FINGERPRINT_NOFINGER:
-            printf("No finger detected\n");
-            return p;
+            tr_info("No finger detected");
+            return -1;
         case FINGERPRINT_PACKETRECIEVEERR:
-            printf("Communication error\n");
-            return p;
+            tr_warn("Communication error");
+            return -1;
         case FINGERPRINT_IMAGEFAIL:
-            printf("Imaging error\n");
-            return p;
-        default:
-            printf("Unknown error\n");
-            return p;
-    }
-
-  // OK success!
-
-    p = finger.image2Tz();
-    switch (p) {
-        case FINGERPRINT_OK:
-            printf("Image converted\n");
-            break;
+            tr_warn("Imaging error");
+            return -1;
         case FINGERPRINT_IMAGEMESS:
-            printf("Image too messy\n");
-            return p;
-        case FINGERPRINT_PACKETRECIEVEERR:
-            printf("Communication error\n");
-            return p;
+            tr_warn("Image too messy");
+            return -1;
         case FINGERPRINT_FEATUREFAIL:
-            printf("Could not find fingerprint feature\n");
-            return p;
         case FINGERPRINT_INVALIDIMAGE:
-            printf("Could not find fingerprint features\n");
-            return p;
+            tr_warn("Could not find fingerprint features");
+            return -1;
+        case FINGERPRINT_NOTFOUND:
+            tr_warn("Did not find a match");
+            return -1;
         default:
-            printf("Unknown error\n");
-            return p;
-    }
-
-    // OK converted!
-    p = finger.fingerSearch();
-    if (p == FINGERPRINT_OK) {
-        printf("Found a print match!\n");
-    } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
-        printf("Communication error\n");
-        return p;
-    } else if (p == FINGERPRINT_NOTFOUND) {
-        printf("Did not find a match\n");
-        return p;
-    } else {
-        printf("Unknown error\n");
-        return p;
+            tr_warn("Unknown error");
+            return -1;
     }
 
     // found a match!
-    printf("Found ID #%d\n",finger.fingerID);
-    printf(" with confidence of %d\n",finger.confidence);
+    tr_info("Found ID #%d with confidence of %d", finger.fingerID, finger.confidence);
 
     return finger.fingerID;
 }
 
 // returns -1 if failed, otherwise returns ID #
-int getFingerprintIDez() {
-    uint8_t p = finger.getImage();
-    if (p != FINGERPRINT_OK)  return -1;
-
-    p = finger.image2Tz();
-    if (p != FINGERPRINT_OK)  return -1;
-
-    p = finger.fingerFastSearch();
+int getFingerprintIDez(Fingerprint& finger) {
+    uint8_t p = finger.identify();
     if (p != FINGERPRINT_OK)  return -1;
 
     // found a match!
-    printf("Found ID #%d\n",finger.fingerID);
-    printf(" with confidence of %d\n",finger.confidence);
+    tr_info("Found ID #%d with confidence of %d", finger.fingerID, finger.confidence);
     return finger.fingerID;
 }
 
-void demoLED(void)
+// Liste d'emplacements donnee par le serveur: "0-49,100-119" (bornes incluses),
+// au plus max intervalles. La lecture s'arrete au premier intervalle mal forme ou
+// hors de la plus grande bibliotheque possible
+uint8_t parse_ranges(mbed::Span<const char> value, Fingerprint_Range* ranges, uint8_t max)
+{
+    uint8_t count = 0;
+    const char* p = value.data();
+    const char* end = p + value.size();
+
+    while (p < end && count < max) {
+        char* next;
+        unsigned long first = strtoul(p, &next, 10);
+        if (next == p) {
+            break;
+        }
+        unsigned long last = first;
+        if (next < end && *next == '-') {
+            p = next + 1;
+            last = strtoul(p, &next, 10);
+            if (next == p || last < first) {
+                break;
+            }
+        }
+        // strtoul() takes "-1" as ULONG_MAX, and the range must fit Fingerprint_Range
+        if (last >= FINGERPRINT_MAX_TEMPLATES) {
+            tr_warn("Template range %lu-%lu out of bounds", first, last);
+            break;
+        }
+        ranges[count].start = first;
+        ranges[count].count = last - first + 1;
+        count++;
+        p = next;
+        while (p < end && (*p == ',' || *p == ' ')) {
+            p++;
+        }
+    }
+    return count;
+}
+
+// Partition de la bibliotheque donnee par le serveur, "*" pour toute la bibliotheque
+void setSearchRanges(mbed::Span<const char> value)
+{
+    Fingerprint_Range ranges[FINGERPRINT_MAX_RANGES];
+    uint8_t count = parse_ranges(value, ranges, FINGERPRINT_MAX_RANGES);
+    for (Door* door : doors) {
+        door->sensor.setSearchRanges(ranges, count);
+    }
+}
+
+void demoLED(Fingerprint& finger)
 {
     // control (3 on)(4off), speed (0-255) , color (1 red, 2 blue, 3 purple), cycles (0 infinit,- 255)
     // LED fully on
@@ -900,77 +603,93 @@ void demoLED(void)
     ThisThread::sleep_for(2000ms);
 }
 
-void breathLED() {
+void breathLED(SensorRing& ring) {
     // Breathe blue LED till we say to stop
-    finger.LEDcontrol(FINGERPRINT_LED_BREATHING, 100, FINGERPRINT_LED_BLUE);
+    ring.set(FINGERPRINT_LED_BREATHING, 100, FINGERPRINT_LED_BLUE);
 }
 
-void breathLEDFast() {
+void breathLEDFast(SensorRing& ring) {
     // Breathe blue LED till we say to stop faster
-    finger.LEDcontrol(FINGERPRINT_LED_BREATHING, 20, FINGERPRINT_LED_BLUE);
+    ring.set(FINGERPRINT_LED_BREATHING, 20, FINGERPRINT_LED_BLUE);
 }
 
-void purpleLED() {
-    finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
+void purpleLED(SensorRing& ring) {
+    ring.set(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
 }
 
-void redLED() {
-    finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
+void redLED(SensorRing& ring) {
+    ring.set(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
 }
 
-void blueLED() {
-    finger.LEDcontrol(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE);
+void blueLED(SensorRing& ring) {
+    ring.set(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_BLUE);
 }
 
-// enroll a fingerprint
-uint8_t getFingerprintEnroll() 
+// enroll a fingerprint in slot id, returns FINGERPRINT_OK or the error code of the
+// step that failed
+uint8_t enrollSlot(Door* door, uint16_t id)
 {
+    Fingerprint& finger = door->sensor;
+    SensorRing& ring = door->ring;
     int p = -1;
-    fD.fall(NULL); 
-    printf("Waiting for valid finger to enroll as #%d\n",id);
+    tr_info("Waiting for valid finger to enroll as #%d",id);
+
+    if (finger.autoCommands) {
+        // le capteur enchaine seul les deux prises, la fusion et l'enregistrement
+        p = finger.autoEnroll(id);
+        if (finger.autoCommands) {
+            if (p != FINGERPRINT_OK) {
+                tr_warn("Enroll failed: 0x%X", p);
+                return p;
+            }
+            tr_info("Stored!");
+            return FINGERPRINT_OK;
+        }
+    }
+
     while (p != FINGERPRINT_OK) 
     {
         p = finger.getImage();
         switch (p) 
         {
             case FINGERPRINT_OK:
-                printf("Image taken\n");
-                purpleLED();
+                tr_debug("Image taken");
+                purpleLED(ring);
                 ThisThread::sleep_for(250ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_NOFINGER:
-                printf(".");
-                blueLED();
+                tr_debug(".");
+                blueLED(ring);
                 ThisThread::sleep_for(500ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_PACKETRECIEVEERR:
-                printf("Communication error\n");
-                blueLED();
+                tr_warn("Communication error");
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_IMAGEFAIL:
-                printf("Imaging error\n");
-                blueLED();
+                tr_warn("Imaging error");
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             default:
-                printf("Unknown error\n");
+                tr_warn("Unknown error");
                 break;
         }
     }
@@ -980,75 +699,75 @@ uint8_t getFingerprintEnroll()
     p = finger.image2Tz(1);
     switch (p) {
         case FINGERPRINT_OK:
-            printf("Image converted");
+            tr_debug("Image converted");
             break;
         case FINGERPRINT_IMAGEMESS:
-            printf("Image too messy\n");
+            tr_warn("Image too messy");
             return p;
         case FINGERPRINT_PACKETRECIEVEERR:
-            printf("Communication error\n");
+            tr_warn("Communication error");
             return p;
         case FINGERPRINT_FEATUREFAIL:
-            printf("Could not find fingerprint features\n");
+            tr_warn("Could not find fingerprint features");
             return p;
         case FINGERPRINT_INVALIDIMAGE:
-            printf("Could not find fingerprint features\n");
+            tr_warn("Could not find fingerprint features");
             return p;
         default:
-            printf("Unknown error\n");
+            tr_warn("Unknown error");
             return p;
     }
 
-    printf("Remove finger\n");
+    tr_info("Remove finger");
     ThisThread::sleep_for(200ms);
     p = 0;
     while (p != FINGERPRINT_NOFINGER) {
-        p = finger.getImage();
+        p = finger.waitRemoved(FINGERPRINT_AUTO_TIMEOUT);
     }
-    printf("ID %d\n",id);
+    tr_info("ID %d",id);
     p = -1;
-    printf("Place same finger again\n");
+    tr_info("Place same finger again");
     while (p != FINGERPRINT_OK) {
         p = finger.getImage();
         switch (p) {
             case FINGERPRINT_OK:
-                printf("Image taken\n");
-                purpleLED();
+                tr_debug("Image taken");
+                purpleLED(ring);
                 ThisThread::sleep_for(250ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_NOFINGER:
-                printf(".");
-                blueLED();
+                tr_debug(".");
+                blueLED(ring);
                 ThisThread::sleep_for(500ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_PACKETRECIEVEERR:
-                printf("Communication error\n");
-                blueLED();
+                tr_warn("Communication error");
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             case FINGERPRINT_IMAGEFAIL:
-                printf("Imaging error\n");
-                blueLED();
+                tr_warn("Imaging error");
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 ThisThread::sleep_for(100ms);
-                blueLED();
+                blueLED(ring);
                 ThisThread::sleep_for(200ms);
-                breathLEDFast();
+                breathLEDFast(ring);
                 break;
             default:
-                printf("Unknown error\n");
+                tr_warn("Unknown error");
                 break;
         }
     }
@@ -1058,85 +777,652 @@ uint8_t getFingerprintEnroll()
     p = finger.image2Tz(2);
     switch (p) {
         case FINGERPRINT_OK:
-            printf("Image converted\n");
+            tr_debug("Image converted");
             break;
         case FINGERPRINT_IMAGEMESS:
-            printf("Image too messy\n");
+            tr_warn("Image too messy");
             return p;
         case FINGERPRINT_PACKETRECIEVEERR:
-            printf("Communication error\n");
+            tr_warn("Communication error");
             return p;
         case FINGERPRINT_FEATUREFAIL:
-            printf("Could not find fingerprint features\n");
+            tr_warn("Could not find fingerprint features");
             return p;
         case FINGERPRINT_INVALIDIMAGE:
-            printf("Could not find fingerprint features\n");
+            tr_warn("Could not find fingerprint features");
             return p;
         default:
-            printf("Unknown error\n");
+            tr_warn("Unknown error");
             return p;
     }
 
     // OK converted!
-    printf("Creating model for #%d\n",id); 
+    tr_info("Creating model for #%d",id); 
 
     p = finger.createModel();
     if (p == FINGERPRINT_OK) {
-        printf("Prints matched!\n");
+        tr_info("Prints matched!");
     } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
-        printf("Communication error\n");
+        tr_warn("Communication error");
         return p;
     } else if (p == FINGERPRINT_ENROLLMISMATCH) {
-        printf("Fingerprints did not match\n");
+        tr_warn("Fingerprints did not match");
         return p;
     } else {
-        printf("Unknown error\n");
+        tr_warn("Unknown error");
         return p;
     }
 
-    printf("ID %d\n",id);
+    tr_info("ID %d",id);
     p = finger.storeModel(id);
     if (p == FINGERPRINT_OK) {
-        printf("Stored!\n");
+        tr_info("Stored!");
     } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
-        printf("Communication error\n");
+        tr_warn("Communication error");
         return p;
     } else if (p == FINGERPRINT_BADLOCATION) {
-        printf("Could not store in that location\n");
+        tr_warn("Could not store in that location");
         return p;
     } else if (p == FINGERPRINT_FLASHERR) {
-        printf("Error writing to flash\n");
+        tr_error("Error writing to flash");
         return p;
     } else {
-        printf("Unknown error\n");
+        tr_warn("Unknown error");
         return p;
     }
-    fD.fall(&fingerDetect); 
-    return id;
+    return FINGERPRINT_OK;
 }
 
+// enroll a fingerprint in the first free slot, returns FINGERPRINT_OK and the slot
+// used in *enrolled, or the error code of the step that failed
+uint8_t getFingerprintEnroll(Door* door, uint16_t* enrolled)
+{
+    Fingerprint& finger = door->sensor;
+    // premier emplacement libre de la table d'occupation ; si elle n'a pas pu etre
+    // lue, on la relit plutot que d'ecraser un modele au hasard
+    int slot = finger.freeSlot();
+    if (slot < 0) {
+        uint8_t p = finger.readIndexTable();
+        if (p != FINGERPRINT_OK) {
+            tr_error("Template index unreadable: 0x%X", p);
+            return p;
+        }
+        slot = finger.freeSlot();
+    }
+    if (slot < 0) {
+        tr_error("Sensor library full");
+        return FINGERPRINT_BADLOCATION;
+    }
+
+    // le doigt reste pose entre les prises : pas de detection jusqu'a la fin, quelle
+    // qu'en soit l'issue
+    finger.enableDetect(false);
+    uint8_t p = enrollSlot(door, slot);
+    finger.enableDetect(true);
+    if (p == FINGERPRINT_OK) {
+        *enrolled = slot;
+    }
+    return p;
+}
+
+//////////////////////////////
+//////     UPLOAD     ////////
+//////////////////////////////
+
+// Flash interne: journal des pointages et cache des autorisations
+FlashIAPBlockDevice flash_bd(MBED_CONF_APP_STORAGE_FLASH_ADDRESS, MBED_CONF_APP_STORAGE_FLASH_SIZE);
+TDBStore flash_store(&flash_bd);
+
+// Journal des pointages, vide vers le serveur par JournalUploader
+SignInJournal journal(&flash_store);
+
+// Ecritures differees en flash (cache des autorisations), hors des threads des lecteurs
+EventQueue storage_queue;
+Thread storage_thread(osPriorityLow, MBED_CONF_APP_STORAGE_THREAD_STACK_SIZE, nullptr, "storage");
+
+// Derniere reponse du serveur pour chaque empreinte
+AuthCache auth_cache(std::chrono::seconds(MBED_CONF_APP_AUTH_CACHE_ALLOW_TTL),
+                     std::chrono::seconds(MBED_CONF_APP_AUTH_CACHE_DENY_TTL),
+#if MBED_CONF_APP_AUTH_CACHE_PERSIST
+                     &flash_store,
+#else
+                     nullptr,
+#endif // MBED_CONF_APP_AUTH_CACHE_PERSIST
+                     &storage_queue);
+
+class JournalUploader {
+    static constexpr uint32_t WAKE_FLAG = 1;
+    static constexpr size_t BATCH_SIZE = MBED_CONF_APP_JOURNAL_UPLOAD_BATCH;
+    static constexpr uint32_t MIN_BACKOFF_MS = 2000;
+    static constexpr uint32_t MAX_BACKOFF_MS = 5 * 60 * 1000;
+
+public:
+    JournalUploader(SignInJournal* journal, Net* net, SocketDemo* sckt) :
+        _journal(journal), _net(net), _sckt(sckt),
+        _thread(osPriorityLow, MBED_CONF_APP_UPLOADER_THREAD_STACK_SIZE, nullptr, "uploader")
+    {
+    }
+
+    void start() {
+        _thread.start(callback(this, &JournalUploader::run));
+    }
+
+    /* a record was appended */
+    void notify() {
+        _flags.set(WAKE_FLAG);
+    }
+
+private:
+    void run() {
+        uint32_t backoff_ms = MIN_BACKOFF_MS;
+
+        while (true) {
+            if (_journal->size() == 0) {
+                _flags.wait_any(WAKE_FLAG);
+            }
+            // let a few more sign-ins gather before paying for a request
+            if (_journal->size() < BATCH_SIZE) {
+                ThisThread::sleep_for(std::chrono::milliseconds(MBED_CONF_APP_JOURNAL_UPLOAD_DELAY_MS));
+            }
+            _flags.clear(WAKE_FLAG);
+
+            if (!_net->wait_connected() || !upload()) {
+                tr_warn("Journal upload failed, retrying in %lu ms", (unsigned long)backoff_ms);
+                ThisThread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                backoff_ms = backoff_ms * 2 < MAX_BACKOFF_MS ? backoff_ms * 2 : MAX_BACKOFF_MS;
+                continue;
+            }
+            backoff_ms = MIN_BACKOFF_MS;
+        }
+    }
+
+    /* send the oldest records as one JSON array, returns false if it should be retried */
+    bool upload() {
+        SignInRecord records[BATCH_SIZE];
+        size_t count = _journal->peek(records, BATCH_SIZE);
+        if (count == 0) {
+            return true;
+        }
+
+        uint64_t now_ms = Kernel::Clock::now().time_since_epoch().count();
+        uint16_t boot = _journal->boot();
+        HttpResponse response = _sckt->apiPOST("/api/sign", [&](JsonWriter& json) {
+            json.begin_array();
+            for (size_t i = 0; i < count; i++) {
+                json.begin_object()
+                    .key("footprint").quoted_number(records[i].fingerprint)
+                    .key("room").string("Bouygues-sb123")
+                    .key("seq").number(records[i].seq);
+                // the clock restarts at every boot, older records have no usable age
+                if (records[i].boot == boot) {
+                    json.key("age").number((now_ms - records[i].time_ms) / 1000);
+                }
+                json.end_object();
+            }
+            json.end_array();
+        });
+        int status_code = response.status;
+        tr_info("Journal upload of %d sign-in(s): %d", (int)count, status_code);
+
+        // 2xx and 4xx are the server's final word on these records, only retry
+        // when it couldn't be reached or failed
+        if (status_code < 200 || status_code >= 500) {
+            return false;
+        }
+        _journal->drop(count);
+        return true;
+    }
+
+    SignInJournal* _journal;
+    Net* _net;
+    SocketDemo* _sckt;
+    Thread _thread;
+    EventFlags _flags;
+};
+
+// Verification d'un doigt sur le thread du lecteur : cache, sinon le serveur, le
+// journal si le serveur ne repond pas
+void Door::verify()
+{
+    METRIC_SCOPE(METRIC_SIGN_IN);
+#if MBED_CONF_APP_PIPELINED_VERIFY
+    // bring the server connection up while the sensor captures and searches
+    _net->get_queue()->call(_sckt, &SocketDemo::warm_up);
+#endif // MBED_CONF_APP_PIPELINED_VERIFY
+    // the ring's commands go through this door's queue, which is busy with us until
+    // the verification is over
+    ring.apply(FINGERPRINT_LED_ON, 0, FINGERPRINT_LED_PURPLE);
+    int id = getFingerprintID(sensor);
+    ring.apply(FINGERPRINT_LED_BREATHING, 100, FINGERPRINT_LED_BLUE);
+
+    if (id < 0) {
+        led(RED, BLINK, 1);
+        return;
+    }
+
+    AuthCache::Result cached = auth_cache.lookup(id);
+    if (cached == AuthCache::DENIED) {
+        tr_warn("Refused (cached)");
+        led(RED, BLINK, 1);
+        return;
+    }
+
+    // known finger: let it in now, the journal writes come after the LED and the
+    // uploader reports it when it can
+    if (cached == AuthCache::ALLOWED) {
+        led(GREEN, SOLID, 1);
+        if (journal.append(id)) {
+            _uploader->notify();
+        } else {
+            tr_error("Door %d: sign-in of #%d not journaled, it won't be reported", _index, id);
+        }
+        return;
+    }
+
+    led(PINK, BLINK, 1);
+
+    // unknown finger: ask the server, the other door waits for the connection if it
+    // needs it at the same time
+    HttpResponse response = {-1, {}};
+    if (_net->wait_connected()) {
+        response = _sckt->apiPOST("/api/sign", [&](JsonWriter& json) {
+            json.begin_object()
+                .key("footprint").quoted_number(id)
+                .key("room").string("Bouygues-sb123");
+#if MBED_CONF_APP_SECOND_DOOR
+            json.key("door").number(_index);
+#endif // MBED_CONF_APP_SECOND_DOOR
+            json.end_object();
+        });
+    }
+
+    int status_code = response.status;
+    tr_info("Door %d received %d", _index, status_code);
+
+    if (status_code == 200) {
+        auth_cache.store(id, true);
+        led(GREEN, SOLID, 1);
+    } else if (status_code == 401) {
+        auth_cache.store(id, false);
+        led(RED, BLINK, 1);
+    } else if (status_code >= 0) {
+        // the server answered but failed: no access it didn't grant
+        tr_warn("Door %d: server error %d, refused", _index, status_code);
+        led(RED, BLINK, 1);
+    } else if (journal.append(id)) {
+        // couldn't reach the server: keep the sign-in for later
+        _uploader->notify();
+        led(GREEN, SOLID, 1);
+    } else {
+        led(RED, BLINK, 3);
+    }
+}
+
+// Les lecteurs gardent les memes numeros de modele : celui enregistre sur un
+// lecteur est recopie sur les autres
+void copy_template(Door* from, uint16_t id)
+{
+    if (sizeof(doors) / sizeof(doors[0]) < 2) {
+        return;
+    }
+    // un modele R503 fait 1536 octets, static : pas sur la pile de main
+    static uint8_t model[2048];
+    uint16_t size = 0;
+    uint8_t p = from->sensor.loadModel(id);
+    if (p == FINGERPRINT_OK) {
+        p = from->sensor.uploadModel(1, model, sizeof(model), &size);
+    }
+    if (p != FINGERPRINT_OK) {
+        tr_warn("Could not read template #%d: 0x%X", id, p);
+        return;
+    }
+    for (Door* door : doors) {
+        if (door == from) {
+            continue;
+        }
+        p = door->sensor.downloadModel(1, model, size);
+        if (p == FINGERPRINT_OK) {
+            p = door->sensor.storeModel(id);
+        }
+        if (p == FINGERPRINT_OK) {
+            auth_cache.invalidate(id);
+        }
+        tr_info("Template #%d copied to door %d: 0x%X", id, door->index(), p);
+    }
+}
+
+
+#if MBED_CONF_APP_METRICS
+// Envoi periodique des histogrammes de latence, remis a zero une fois acceptes
+void post_metrics(SocketDemo* sckt)
+{
+    HttpResponse response = sckt->apiPOST("/api/metrics", [](JsonWriter& json) {
+        json.begin_object()
+            .key("room").string("Bouygues-sb123")
+            .key("metrics");
+        Metrics::write_json(json);
+        json.key("pools");
+        Metrics::write_pools_json(json);
+        json.key("sensors").begin_array();
+        for (Door* door : doors) {
+            json.begin_object()
+                .key("door").number(door->index())
+                .key("retries").number(door->sensor.retryCount())
+                .key("bad_frames").number(door->sensor.rxErrorCount())
+                .key("lost_bytes").number(door->sensor.rxOverflowCount())
+                .key("images_retaken").number(door->sensor.captureRetryCount())
+                .end_object();
+        }
+        json.end_array();
+        json.end_object();
+    });
+    if (response.status == 200) {
+        Metrics::reset();
+    }
+}
+#endif // MBED_CONF_APP_METRICS
+
+// Modeles que le serveur fait effacer (parse_ranges() de "3-5,10"), chaque
+// intervalle en une commande
+void delete_templates(const Fingerprint_Range* ranges, uint8_t count)
+{
+    // the slots get enrolled again, the cached answers went with their fingers
+    for (uint8_t i = 0; i < count; i++) {
+        auth_cache.invalidate(ranges[i].start, ranges[i].count);
+    }
+    for (Door* door : doors) {
+        for (uint8_t i = 0; i < count; i++) {
+            // only what exists in the library of this sensor, which may be the smaller one
+            if (ranges[i].start + ranges[i].count > door->sensor.capacity) {
+                tr_warn("Door %d has no templates #%d-%d", door->index(), ranges[i].start,
+                        ranges[i].start + ranges[i].count - 1);
+                continue;
+            }
+            uint8_t p = door->sensor.deleteModels(ranges[i].start, ranges[i].count);
+            tr_info("Door %d deleted templates #%d-%d: 0x%X", door->index(), ranges[i].start,
+                    ranges[i].start + ranges[i].count - 1, p);
+        }
+    }
+}
+
+#if MBED_CONF_APP_TEMPLATE_SYNC
+// Rapprochement avec le serveur : il recoit la table d'occupation du capteur (en
+// hexadecimal, capacity/8 octets) et repond les emplacements a effacer, sur tous
+// les lecteurs. Faux s'il faut recommencer (serveur injoignable ou en erreur)
+bool sync_templates(Door* door, SocketDemo* sckt)
+{
+    uint8_t bitmap[FINGERPRINT_MAX_TEMPLATES / 8];
+    uint16_t bytes = door->sensor.copyIndexTable(bitmap, sizeof(bitmap));
+    if (bytes == 0) {
+        return true;
+    }
+    char hex[2 * sizeof(bitmap) + 1];
+    for (uint16_t i = 0; i < bytes; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", bitmap[i]);
+    }
+    hex[2 * bytes] = '\0';
+
+    // the ranges are taken out of the body before the client lets go of its buffer,
+    // the sensors are only busy once the request is over
+    Fingerprint_Range ranges[FINGERPRINT_MAX_RANGES];
+    uint8_t count = 0;
+    HttpResponse response = sckt->apiPOST("/api/templates", [&](JsonWriter& json) {
+        json.begin_object()
+            .key("room").string("Bouygues-sb123")
+            .key("capacity").number(door->sensor.capacity)
+            .key("index").string(hex);
+#if MBED_CONF_APP_SECOND_DOOR
+        json.key("door").number(door->index());
+#endif // MBED_CONF_APP_SECOND_DOOR
+        json.end_object();
+    }, [&](const HttpResponse& reply) {
+        if (reply.status == 200) {
+            count = parse_ranges(json_string(reply.body, "delete"), ranges, FINGERPRINT_MAX_RANGES);
+        }
+    });
+    if (response.status != 200) {
+        tr_warn("Template sync: %d", response.status);
+        // a 4xx is the server's final word on this index
+        return response.status >= 400 && response.status < 500;
+    }
+
+    delete_templates(ranges, count);
+    return true;
+}
+#endif // MBED_CONF_APP_TEMPLATE_SYNC
+
+// Au demarrage, une fois le lien monte : ping (version des regles d'acces) puis
+// rapprochement des modeles de chaque lecteur, repris avec un delai croissant tant
+// que le serveur ne repond pas. Tourne sur la file du reseau, entre deux connexions
+class StartupSync {
+    static constexpr uint32_t MIN_BACKOFF_MS = 2000;
+    static constexpr uint32_t MAX_BACKOFF_MS = 5 * 60 * 1000;
+    static constexpr size_t DOOR_COUNT = sizeof(doors) / sizeof(doors[0]);
+
+public:
+    StartupSync(Net* net, SocketDemo* sckt) : _net(net), _sckt(sckt)
+    {
+    }
+
+    void start() {
+        _net->get_queue()->call(this, &StartupSync::run);
+    }
+
+private:
+    void run() {
+        // the link comes up on this very queue, so it is checked rather than waited for
+        if (!_net->is_connected()) {
+            _net->get_queue()->call_in(std::chrono::milliseconds(MIN_BACKOFF_MS), this, &StartupSync::run);
+            return;
+        }
+        if (step()) {
+            return;
+        }
+        _net->get_queue()->call_in(std::chrono::milliseconds(_backoff_ms), this, &StartupSync::run);
+        _backoff_ms = _backoff_ms * 2 < MAX_BACKOFF_MS ? _backoff_ms * 2 : MAX_BACKOFF_MS;
+    }
+
+    /* what is left to do, true once everything went through */
+    bool step() {
+        if (!_pinged) {
+            _pinged = _sckt->apiPing();
+            if (!_pinged) {
+                tr_warn("Startup ping failed, retrying in %lu ms", (unsigned long)_backoff_ms);
+                return false;
+            }
+        }
+#if MBED_CONF_APP_TEMPLATE_SYNC
+        for (; _synced < DOOR_COUNT; _synced++) {
+            if (!sync_templates(doors[_synced], _sckt)) {
+                return false;
+            }
+        }
+#endif // MBED_CONF_APP_TEMPLATE_SYNC
+        return true;
+    }
+
+    Net* _net;
+    SocketDemo* _sckt;
+    uint32_t _backoff_ms = MIN_BACKOFF_MS;
+    bool _pinged = false;
+    size_t _synced = 0; // lecteurs deja rapproches
+};
+
+#if MBED_CONF_APP_PUSH_CHANNEL
+/* long poll of /api/events on a connection of its own: the server holds the request
+ * until it has something for this reader, or push-hold seconds. An answer carries
+ * the usual X-Auth-Version and X-Search-Ranges headers, and optionally "revoke" (cached
+ * answers to forget) and "delete" (templates to delete) lists of IDs. 204 means nothing
+ * happened, the next poll goes out at once over the same connection */
+class PushChannel {
+    static constexpr uint32_t MIN_BACKOFF_MS = 2000;
+    static constexpr uint32_t MAX_BACKOFF_MS = 5 * 60 * 1000;
+
+public:
+    PushChannel(Net* net, SocketDemo* sckt) :
+        _net(net), _sckt(sckt),
+        _thread(osPriorityLow, MBED_CONF_APP_PUSH_THREAD_STACK_SIZE, nullptr, "push")
+    {
+    }
+
+    void start() {
+        _thread.start(callback(this, &PushChannel::run));
+    }
+
+private:
+    void run() {
+        char endpoint[64];
+        snprintf(endpoint, sizeof(endpoint), "/api/events?room=Bouygues-sb123&wait=%d", MBED_CONF_APP_PUSH_HOLD);
+        uint32_t backoff_ms = MIN_BACKOFF_MS;
+
+        while (true) {
+            HttpResponse response = {-1, {}};
+            Events events;
+            if (_net->wait_connected()) {
+                response = _sckt->apiGET(endpoint, [&](const HttpResponse& reply) {
+                    if (reply.status == 200) {
+                        events.parse(reply.body);
+                    }
+                });
+            }
+            if (response.status == 200) {
+                handle(events);
+            }
+            if (response.status != 200 && response.status != 204) {
+                tr_warn("Push channel: %d, retrying in %lu ms", response.status, (unsigned long)backoff_ms);
+                ThisThread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                backoff_ms = backoff_ms * 2 < MAX_BACKOFF_MS ? backoff_ms * 2 : MAX_BACKOFF_MS;
+                continue;
+            }
+            backoff_ms = MIN_BACKOFF_MS;
+        }
+    }
+
+    /* the lists of an answer, copied out of the client's buffer */
+    struct Events {
+        Fingerprint_Range revoke[FINGERPRINT_MAX_RANGES];
+        uint8_t revoke_count = 0;
+        Fingerprint_Range remove[FINGERPRINT_MAX_RANGES];
+        uint8_t remove_count = 0;
+
+        void parse(mbed::Span<const char> body) {
+            revoke_count = parse_ranges(json_string(body, "revoke"), revoke, FINGERPRINT_MAX_RANGES);
+            remove_count = parse_ranges(json_string(body, "delete"), remove, FINGERPRINT_MAX_RANGES);
+        }
+    };
+
+    void handle(const Events& events) {
+        const Fingerprint_Range* ranges = events.revoke;
+        uint8_t count = events.revoke_count;
+        for (uint8_t i = 0; i < count; i++) {
+            auth_cache.invalidate(ranges[i].start, ranges[i].count);
+            tr_info("Cached answers revoked for #%d-%d", ranges[i].start, ranges[i].start + ranges[i].count - 1);
+        }
+        delete_templates(events.remove, events.remove_count);
+    }
+
+    Net* _net;
+    SocketDemo* _sckt;
+    Thread _thread;
+};
+#endif // MBED_CONF_APP_PUSH_CHANNEL
+
+// Mise en veille : anneaux LED et UART des capteurs coupes, le Wi-Fi aussi si configure
+void enter_idle(Net* net)
+{
+    for (Door* door : doors) {
+        door->sensor.sleep();
+    }
+#if MBED_CONF_APP_IDLE_WIFI_OFF
+    net->suspend();
+#endif // MBED_CONF_APP_IDLE_WIFI_OFF
+}
+
+void leave_idle(Net* net)
+{
+    for (Door* door : doors) {
+        door->sensor.wake();
+        door->ring.restore();
+    }
+    net->resume();
+}
+
+// Sortie des traces, ecrite sur la console par un thread de basse priorite
+LogSink log_sink;
+
 int main() {
-    printf("\r\nStarting IOT-AUTH System\r\n\r\n");
+    log_sink.start();
+    tr_info("Starting IOT-AUTH System");
+    Metrics::init();
+
+    ui_thread.start(callback(&ui_queue, &EventQueue::dispatch_forever));
+    keypad.start();
+
+    // le Wi-Fi se connecte en arriere-plan pendant l'initialisation du capteur
+    // static : les sockets TLS et les tampons ne pesent pas sur la pile de main
+    static Net net;
+    net.init();
+
+    for (Door* door : doors) {
+        door->start();
+        setup(door);
+    }
+#if MBED_CONF_APP_BOOT_LED_DEMO
+    demoLED(door0.sensor);
+#endif // MBED_CONF_APP_BOOT_LED_DEMO
+    for (Door* door : doors) {
+        door->sensor.LEDcontrol(3,128,1,10);
+    }
+
+    bool journal_ready = false;
+    int storage_result = flash_store.init();
+    if (storage_result == MBED_SUCCESS) {
+        storage_thread.start(callback(&storage_queue, &EventQueue::dispatch_forever));
+        auth_cache.init();
+        journal_ready = journal.init() == MBED_SUCCESS;
+    } else {
+        tr_error("Error! flash storage init returned: %d", storage_result);
+    }
 
-#ifdef MBED_CONF_MBED_TRACE_ENABLE
-    mbed_trace_init();
-#endif
+    static SocketDemo sckt(net.get_netif(), net.get_queue());
+    sckt.attach_auth_version(callback(&auth_cache, &AuthCache::set_version));
+    sckt.attach_search_ranges(callback(setSearchRanges));
+
+    // Make a ping request to the server, on the network thread once the link is up: it
+    // only checks the server and fetches the access rules version, nothing waits for it
+    static StartupSync startup_sync(&net, &sckt);
+    startup_sync.start();
+
+#if MBED_CONF_APP_PUSH_CHANNEL
+    // la requete en attente occupe sa connexion, les autres requetes ont la leur
+    static SocketDemo push_sckt(net.get_netif(), net.get_queue(), (MBED_CONF_APP_PUSH_HOLD + 10) * 1000);
+    push_sckt.attach_auth_version(callback(&auth_cache, &AuthCache::set_version));
+    push_sckt.attach_search_ranges(callback(setSearchRanges));
+    static PushChannel push(&net, &push_sckt);
+    push.start();
+#endif // MBED_CONF_APP_PUSH_CHANNEL
+
+    static JournalUploader uploader(&journal, &net, &sckt);
+    if (journal_ready) {
+        uploader.start();
+    }
+    for (Door* door : doors) {
+        door->attach(&net, &sckt, &uploader);
+    }
 
-    setup();
-    demoLED();
-    finger.LEDcontrol(3,128,1,10);
-    printf("\nPret ! \n");
+    idle_manager.attach(callback(enter_idle, &net), callback(leave_idle, &net));
+    for (Door* door : doors) {
+        door->sensor.attachWakeAck(callback(&idle_manager, &IdleManager::ready));
+    }
 
-    // Make a ping request to the serer
-    Net net;
-    net.preinit();
-    SocketDemo *sckt = new SocketDemo(net.get_netif());
-    MBED_ASSERT(sckt);
-    sckt->apiPing();
-    delete sckt;
+#if MBED_CONF_APP_METRICS
+    net.get_queue()->call_every(std::chrono::seconds(MBED_CONF_APP_METRICS_PERIOD), post_metrics, &sckt);
+#endif // MBED_CONF_APP_METRICS
 
-    unsigned char c=1;
-    breathLED();
+    for (Door* door : doors) {
+        breathLED(door->ring);
+    }
+    tr_info("Pret ! (%lu ms)", (unsigned long)Kernel::Clock::now().time_since_epoch().count());
 
     while (true) {
         reset = 0;
@@ -1144,17 +1430,17 @@ int main() {
         //white led
         led(WHITE, SOLID, 0);
         //keycode A is pressed
-        printf("waiting for A to be pressed\n");
+        tr_info("waiting for A to be pressed");
         //char init_key = '\0';
         //while (init_key == 'A' || init_key == 'B') {init_key=wait_falling_edge();}
-        char pressed_init_key = wait_choice_key_falling(INIT_KEYS, 2) ;
+        char pressed_init_key = wait_choice_key_falling(INIT_KEYS, sizeof(INIT_KEYS)) ;
         if (pressed_init_key == 'A') {
             //Blue led 
             led(BLUE, BLINK, 1);
             char code[5] = {};
             int indice = 0;
             while (indice <= 5) {
-                printf("waiting for number\n");
+                tr_info("waiting for number");
                 char pressed = '\0';
                 led(CYAN, BLINK, 1);
                 // ces lettres sont cursed pour un raison inconnue
@@ -1163,7 +1449,7 @@ int main() {
                 }
                 code[indice] = pressed;
                 indice += 1;
-                printf("indice %d | key = %c\n", indice, pressed);
+                tr_debug("indice %d | key = %c", indice, pressed);
                 
                 if (pressed == 'B') {
                     reset = 1;
@@ -1175,131 +1461,118 @@ int main() {
             }
             // check code
             // Make a POST request to the server
-            net.preinit();
-            sckt = new SocketDemo(net.get_netif());
-            MBED_ASSERT(sckt);
-            std::string json_payload = R"({
-                "initcode": ")" + std::string(code) + R"(",
-                "room": "Bouygues-sb123"
-            })";
-            std::pair<int, char*> response = sckt->apiPOST("/api/check", json_payload.c_str());
-            delete sckt;
-
-            int status_code = response.first;
-            printf("Received %d", status_code);
+            net.wait_connected();
+            // "message" is read while the client still holds the response
+            bool found = false;
+            int intValue = 0;
+            HttpResponse response = sckt.apiPOST("/api/check", [&](JsonWriter& json) {
+                json.begin_object()
+                    .key("initcode").string(code)
+                    .key("room").string("Bouygues-sb123")
+                    .end_object();
+            }, [&](const HttpResponse& reply) {
+                // Find the key "message"
+                mbed::Span<const char> value = json_string(reply.body, "message");
+                found = !value.empty();
+                if (!found) {
+                    return;
+                }
+                tr_info("Extracted value (remaining ident): %.*s", (int)value.size(), value.data());
+                for (char digit : value) {
+                    if (digit < '0' || digit > '9') {
+                        break;
+                    }
+                    intValue = intValue * 10 + digit - '0';
+                }
+            });
+
+            int status_code = response.status;
+            tr_info("Received %d", status_code);
 
             if (status_code != 200) {
                 led(RED, BLINK, 1);
                 continue;
             }
 
-            char* json = response.second;
-            printf("Received JSON response:\r\n%s\r\n", json);
-
-            // Find the key "message"
-            char* start = strstr(json, "\"message\":");
-            if (start == NULL) {
-                printf("Key 'message' not found!\n");
+            if (!found) {
+                tr_warn("Key 'message' not found!");
                 return 1;
             }
 
-            // Move the pointer past the "message": part to the value
-            start = strchr(start, '\"') + 1; // Skip the first quote after "message"
-            char* end = strchr(start, '\"');  // Find the closing quote of the value
-
-            if (start && end) {
-                // Extract the value (this assumes there's no extra spaces in the value)
-                size_t length = end - start;
-                char value[length + 1];
-                strncpy(value, start, length);
-                value[length] = '\0';  // Null-terminate the extracted value
-
-                // Print the extracted value
-                printf("Extracted value (remaining ident): %s\n", value);
-
-                int intValue = atoi(value);
-
-                // si le keycode a toujours des slot utilisable
-                if (intValue > 0) {
-                    printf("Fingerprint Enroll");
-                    breathLEDFast();
-                    c=getFingerprintEnroll();
-                    breathLED();
-
-                    // Make a POST request to the server
-                    net.preinit();
-                    sckt = new SocketDemo(net.get_netif());
-                    MBED_ASSERT(sckt);
-                    std::string json_payload = R"({
-                        "initcode": ")" + std::string(code) + R"(",
-                        "footprint": ")" + std::to_string(c) + R"(",
-                        "room": "Bouygues-sb123"
-                    })";
-                    std::pair<int, char*> response = sckt->apiPOST("/api/ident", json_payload.c_str());
-                    delete sckt;
-
-                    int status_code = response.first;
-                    printf("Received %d", status_code);
-
-                    if (status_code == 200) {
-                        printf("Registration finished\n");
-                        led(GREEN, BLINK,3);
-                        printf("waiting for A to be pressed\n");
-                        while (wait_falling_edge() == 'A') {}
-                    } else if (status_code == 401) {
-                        printf("Unauthorized registration\n");
-                        led(RED, BLINK,3);
-                        continue;
-                    } else {
-                        printf("Server responded with status: %d", status_code);
-                        led(RED, BLINK,3);
-                        continue;
-                    }
+            // si le keycode a toujours des slot utilisable
+            if (intValue > 0) {
+                // enregistre sur le premier lecteur, recopie sur les autres
+                tr_info("Fingerprint Enroll");
+                breathLEDFast(door0.ring);
+                uint16_t enrolled = 0;
+                uint8_t p = getFingerprintEnroll(&door0, &enrolled);
+                breathLED(door0.ring);
+                // nothing was stored, the server is not told about a slot
+                if (p != FINGERPRINT_OK) {
+                    tr_warn("Enroll failed: 0x%X", p);
+                    led(RED, BLINK, 3);
+                    continue;
+                }
+                // the slot may have been someone else's, whose answer must not carry over
+                auth_cache.invalidate(enrolled);
+                copy_template(&door0, enrolled);
+
+                // Make a POST request to the server
+                net.wait_connected();
+                HttpResponse response = sckt.apiPOST("/api/ident", [&](JsonWriter& json) {
+                    json.begin_object()
+                        .key("initcode").string(code)
+                        .key("footprint").quoted_number(enrolled)
+                        .key("room").string("Bouygues-sb123")
+                        .end_object();
+                });
+
+                int status_code = response.status;
+                tr_info("Received %d", status_code);
+
+                if (status_code == 200) {
+                    tr_info("Registration finished");
+                    led(GREEN, BLINK,3);
+                    tr_info("waiting for A to be pressed");
+                    while (wait_falling_edge() == 'A') {}
+                } else if (status_code == 401) {
+                    tr_warn("Unauthorized registration");
+                    led(RED, BLINK,3);
+                    continue;
+                } else {
+                    tr_warn("Server responded with status: %d", status_code);
+                    led(RED, BLINK,3);
+                    continue;
                 }
-            } else {
-                printf("Failed to extract value.\n");
-                continue;
             }
 
+        } else if (pressed_init_key == 'D') {
+            // debug: where the time of a sign-in goes
+            Metrics::print();
+            Metrics::print_stacks();
+            for (Door* door : doors) {
+                printf("door %d: %lu command retries, %lu bad frames, %lu bytes lost, %lu images retaken\r\n",
+                       door->index(), (unsigned long)door->sensor.retryCount(),
+                       (unsigned long)door->sensor.rxErrorCount(), (unsigned long)door->sensor.rxOverflowCount(),
+                       (unsigned long)door->sensor.captureRetryCount());
+            }
         } else if (pressed_init_key == 'B') {
             //left loop
             int res_statues = 0;
             //boucle pour s'assurer d'un bon scan
-            while (scan_falling_char() != 'A') {
+            while (true) {
                 led(CYAN, SOLID, 0);
-                if(fingerON){
-                    printf("Doigt detecte ! \n");     
-                    purpleLED();
-                    uint8_t id = getFingerprintID();
-                    ThisThread::sleep_for(100ms); 
-                    breathLED();
-                    fingerON=false;
-
-                    led(PINK, BLINK, 1);
-
-                    // Make a POST request to the server
-                    net.preinit();
-                    sckt = new SocketDemo(net.get_netif());
-                    MBED_ASSERT(sckt);
-                    std::string json_payload = R"({
-                        "footprint": ")" + std::to_string(id) + R"(",
-                        "room": "Bouygues-sb123"
-                    })";
-                    std::pair<int, char*> response = sckt->apiPOST("/api/sign", json_payload.c_str());
-                    delete sckt;
-
-                    int status_code = response.first;
-                    printf("Received %d", status_code);
-
-                    if (status_code != 401) {
-                        if (status_code != 200) {
-                            return 404; // couldn't connect to server
-                            
-                            //printf("sending failed trying again");
-                            //ThisThread::sleep_for(200ms);
-                        }
-                        led(GREEN, SOLID, 1);
+                AppEvent event = wait_event();
+                if (event.type == KEY_EVENT) {
+                    if (event.key == 'A') {
+                        break;
                     }
+                    continue;
+                }
+                if (event.type == FINGER_EVENT) {
+                    // verifie sur le thread du lecteur, l'autre porte reste disponible
+                    tr_info("Doigt detecte (porte %d) !", event.door);
+                    doors[event.door]->sign_in();
                 }
             }
         }
@@ -0,0 +1,130 @@
+/* HTTP server on the host sockets
+ */
+
+#include "LoopbackServer.h"
+#include <cstdlib>
+#include <strings.h>
+
+namespace {
+/* round trips of a TCP handshake, then of a full TLS 1.2 handshake */
+constexpr uint32_t TCP_HANDSHAKE_RTTS = 1;
+constexpr uint32_t TLS_HANDSHAKE_RTTS = 2;
+
+const char *reason(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        default: return "Status";
+    }
+}
+
+/* value of a request header, empty if it is not there */
+std::string header(const std::string &head, const char *name)
+{
+    size_t length = strlen(name);
+    for (size_t line = head.find("\r\n"); line != std::string::npos; line = head.find("\r\n", line + 2)) {
+        if (line + 2 + length < head.size() && head[line + 2 + length] == ':' &&
+            strncasecmp(head.c_str() + line + 2, name, length) == 0) {
+            size_t value = head.find_first_not_of(' ', line + 3 + length);
+            return head.substr(value, head.find("\r\n", value) - value);
+        }
+    }
+    return std::string();
+}
+}
+
+LoopbackServer::LoopbackServer(uint16_t port, const RttProfile &rtt, Handler handler) :
+    _port(port),
+    _rtt(rtt),
+    _handler(std::move(handler))
+{
+    mbed_host::listen(_port, this);
+}
+
+LoopbackServer::~LoopbackServer()
+{
+    mbed_host::listen(_port, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &connection : _open) {
+            connection->close();
+        }
+    }
+    for (std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+nsapi_error_t LoopbackServer::accept(std::shared_ptr<mbed_host::Connection> connection, bool tls)
+{
+    uint32_t rtts = TCP_HANDSHAKE_RTTS + (tls ? TLS_HANDSHAKE_RTTS : 0);
+    mbed_host::wait_until(std::chrono::steady_clock::now() + std::chrono::microseconds(rtts * _rtt.rtt_us));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _open.push_back(connection);
+    _threads.emplace_back(&LoopbackServer::serve, this, connection);
+    _connections++;
+    return NSAPI_ERROR_OK;
+}
+
+void LoopbackServer::serve(std::shared_ptr<mbed_host::Connection> connection)
+{
+    std::string input;
+    char buffer[512];
+
+    while (true) {
+        size_t end;
+        while ((end = input.find("\r\n\r\n")) == std::string::npos) {
+            nsapi_size_or_error_t count = connection->up.read(buffer, sizeof(buffer), -1);
+            if (count <= 0) {
+                connection->close();
+                return;
+            }
+            input.append(buffer, count);
+        }
+        std::string head = input.substr(0, end);
+        size_t body_length = strtoul(header(head, "Content-Length").c_str(), nullptr, 10);
+        while (input.size() < end + 4 + body_length) {
+            nsapi_size_or_error_t count = connection->up.read(buffer, sizeof(buffer), -1);
+            if (count <= 0) {
+                connection->close();
+                return;
+            }
+            input.append(buffer, count);
+        }
+
+        Request request;
+        size_t space = head.find(' ');
+        request.method = head.substr(0, space);
+        request.path = head.substr(space + 1, head.find(' ', space + 1) - space - 1);
+        request.body = input.substr(end + 4, body_length);
+        input.erase(0, end + 4 + body_length);
+        bool close = strcasecmp(header(head, "Connection").c_str(), "close") == 0;
+
+        Response response = _handler(request);
+        _requests++;
+
+        char status_line[128];
+        snprintf(status_line, sizeof(status_line),
+                 "HTTP/1.1 %d %s\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Content-Length: %u\r\n"
+                 "Connection: %s\r\n"
+                 "\r\n",
+                 response.status, reason(response.status), (unsigned)response.body.size(),
+                 close ? "close" : "keep-alive");
+        std::string output = status_line + response.body;
+
+        // half a round trip for the request to come, half for the answer to go back
+        mbed_host::wait_until(std::chrono::steady_clock::now() + std::chrono::microseconds(_rtt.rtt_us));
+        connection->down.write(output.data(), output.size());
+        if (close) {
+            connection->close();
+            return;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/* HTTP server on the host sockets
+ *
+ * Accepts the connections made to its port, reads each request (headers and
+ * Content-Length body) and answers with the status and JSON body its handler
+ * returns, keeping the connection open unless the request asked to close it.
+ * The RTT profile delays every answer by one round trip, and the connection by
+ * the round trips of the TCP handshake and, for a TLSSocket, of a full TLS 1.2
+ * handshake.
+ */
+
+#ifndef LOOPBACK_SERVER_H
+#define LOOPBACK_SERVER_H
+
+#include "mbed.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* network between the reader and the server */
+struct RttProfile {
+    const char *name;
+    uint32_t rtt_us;
+};
+
+class LoopbackServer : public mbed_host::Listener {
+public:
+    struct Request {
+        std::string method;
+        std::string path;
+        std::string body;
+    };
+
+    struct Response {
+        int status;
+        std::string body;
+    };
+
+    typedef std::function<Response(const Request &)> Handler;
+
+    LoopbackServer(uint16_t port, const RttProfile &rtt, Handler handler);
+    ~LoopbackServer();
+
+    nsapi_error_t accept(std::shared_ptr<mbed_host::Connection> connection, bool tls) override;
+
+    unsigned connections() const { return _connections; }
+    unsigned requests() const { return _requests; }
+
+private:
+    void serve(std::shared_ptr<mbed_host::Connection> connection);
+
+    uint16_t _port;
+    RttProfile _rtt;
+    Handler _handler;
+    std::mutex _mutex;
+    std::vector<std::shared_ptr<mbed_host::Connection>> _open;
+    std::vector<std::thread> _threads;
+    std::atomic<unsigned> _connections{0};
+    std::atomic<unsigned> _requests{0};
+};
+
+#endif
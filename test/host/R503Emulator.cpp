@@ -0,0 +1,189 @@
+/* Scripted R503 on the other end of a host UART
+ */
+
+#include "R503Emulator.h"
+#include "Fingerprint.h"
+
+R503Emulator::R503Emulator(PinName tx, const LineProfile &line) :
+    mbed_host::SerialDevice(tx),
+    _line(line),
+    _random(503),
+    _thread(&R503Emulator::run, this)
+{
+}
+
+R503Emulator::~R503Emulator()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _changed.notify_all();
+    }
+    _thread.join();
+}
+
+R503Emulator::Frame R503Emulator::ack(std::initializer_list<uint8_t> payload)
+{
+    return packet(FINGERPRINT_ACKPACKET, payload);
+}
+
+R503Emulator::Frame R503Emulator::ack(const std::vector<uint8_t> &payload)
+{
+    return packet(FINGERPRINT_ACKPACKET, payload);
+}
+
+R503Emulator::Frame R503Emulator::packet(uint8_t type, const std::vector<uint8_t> &payload)
+{
+    Frame frame(payload.size() + FINGERPRINT_FRAME_OVERHEAD);
+    encodeFingerprintFrame(frame.data(), 0xFFFFFFFF, type, payload.data(), payload.size());
+    return frame;
+}
+
+void R503Emulator::script(uint8_t command, std::vector<Frame> frames, uint32_t delay_us)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _script[command].push_back({std::move(frames), delay_us});
+}
+
+void R503Emulator::respond(uint8_t command, std::vector<Frame> frames, uint32_t delay_us)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _standing[command] = {std::move(frames), delay_us};
+}
+
+void R503Emulator::send(const Frame &bytes, uint32_t delay_us, bool burst)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    queue({bytes}, delay_us, burst);
+}
+
+void R503Emulator::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _pending.empty() && !_sending; });
+}
+
+size_t R503Emulator::commands(uint8_t command)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return command ? _commands[command] : _command_count;
+}
+
+size_t R503Emulator::data_bytes()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _data_bytes;
+}
+
+// The driver writes whole frames, but nothing forces it to: bytes are gathered
+// until the frame the header announces is complete
+void R503Emulator::received(const uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _input.insert(_input.end(), data, data + size);
+
+    while (true) {
+        // resynchronise on the start code
+        size_t start = 0;
+        while (start + 1 < _input.size() &&
+               (_input[start] != (FINGERPRINT_STARTCODE >> 8) || _input[start + 1] != (FINGERPRINT_STARTCODE & 0xFF))) {
+            start++;
+        }
+        _input.erase(_input.begin(), _input.begin() + start);
+        if (_input.size() < 9) {
+            return;
+        }
+        size_t length = ((size_t)_input[7] << 8) | _input[8];
+        if (length < 2) {
+            _input.erase(_input.begin(), _input.begin() + 2);
+            continue;
+        }
+        if (_input.size() < 9 + length) {
+            return;
+        }
+        uint8_t type = _input[6];
+        const uint8_t *payload = &_input[9];
+        if (type == FINGERPRINT_COMMANDPACKET) {
+            command(payload, length - 2);
+        } else if (type == FINGERPRINT_DATAPACKET || type == FINGERPRINT_ENDDATAPACKET) {
+            _data_bytes += length - 2;
+        }
+        _input.erase(_input.begin(), _input.begin() + 9 + length);
+    }
+}
+
+// Called with _mutex held
+void R503Emulator::command(const uint8_t *payload, size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+    uint8_t code = payload[0];
+    _commands[code]++;
+    _command_count++;
+
+    std::deque<Reply> &scripted = _script[code];
+    if (!scripted.empty()) {
+        queue(scripted.front().frames, scripted.front().delay_us);
+        scripted.pop_front();
+        return;
+    }
+    auto standing = _standing.find(code);
+    if (standing != _standing.end()) {
+        queue(standing->second.frames, standing->second.delay_us);
+        return;
+    }
+    queue({ack({FINGERPRINT_OK})}, 0);
+}
+
+// Called with _mutex held, what is queued goes out after what already is
+void R503Emulator::queue(const std::vector<Frame> &frames, uint32_t delay_us, bool burst)
+{
+    Transmission transmission;
+    transmission.burst = burst;
+    transmission.when = std::chrono::steady_clock::now() + std::chrono::microseconds(delay_us);
+    for (const Frame &frame : frames) {
+        transmission.bytes.insert(transmission.bytes.end(), frame.begin(), frame.end());
+    }
+    _pending.push_back(std::move(transmission));
+    _changed.notify_all();
+}
+
+void R503Emulator::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::chrono::steady_clock::time_point line_free = std::chrono::steady_clock::now();
+
+    while (true) {
+        _changed.wait(lock, [this] { return _stopping || !_pending.empty(); });
+        if (_stopping) {
+            return;
+        }
+        Transmission transmission = std::move(_pending.front());
+        _pending.pop_front();
+        _sending = true;
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point next = std::max(transmission.when, line_free);
+        for (uint8_t byte : transmission.bytes) {
+            int baud = this->baud();
+            uint32_t byte_us = 10 * 1000000 / (baud ? baud : 57600);
+            uint32_t jitter_us = _line.jitter_us ? _random() % (_line.jitter_us + 1) : 0;
+            next += std::chrono::microseconds(byte_us);
+            if (!transmission.burst) {
+                mbed_host::wait_until(next);
+                transmit(&byte, 1);
+            }
+            next += std::chrono::microseconds(_line.gap_us + jitter_us);
+        }
+        if (transmission.burst) {
+            mbed_host::wait_until(next);
+            transmit(transmission.bytes.data(), transmission.bytes.size());
+        }
+        line_free = next;
+
+        lock.lock();
+        _sending = false;
+        _changed.notify_all();
+    }
+}
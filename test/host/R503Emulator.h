@@ -0,0 +1,98 @@
+/* Scripted R503 on the other end of a host UART
+ *
+ * Decodes the frames the driver writes and answers each command with the frames
+ * of a script: the replies queued for that instruction code in order, else the
+ * standing reply of the code, else a plain OK ack. Data packets (DownChar) are
+ * only recorded. Replies go out on the emulator thread one byte at a time, at
+ * the UART rate plus the gap of the line profile, each byte running the
+ * driver's RX interrupt handler as it arrives. The sensor's own processing time
+ * is the delay given with the reply.
+ */
+
+#ifndef R503_EMULATOR_H
+#define R503_EMULATOR_H
+
+#include "mbed.h"
+#include <condition_variable>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+/* timing of the bytes the sensor sends, on top of their time on the wire */
+struct LineProfile {
+    const char *name;
+    uint32_t gap_us;    // idle time after every byte
+    uint32_t jitter_us; // random extra idle time, up to this, after every byte
+};
+
+class R503Emulator : public mbed_host::SerialDevice {
+public:
+    typedef std::vector<uint8_t> Frame;
+
+    R503Emulator(PinName tx, const LineProfile &line);
+    ~R503Emulator();
+
+    /* an ack frame, payload starts with the confirmation code */
+    static Frame ack(std::initializer_list<uint8_t> payload);
+    static Frame ack(const std::vector<uint8_t> &payload);
+    static Frame packet(uint8_t type, const std::vector<uint8_t> &payload);
+
+    /* answer the next command with this code with frames, delay_us after it */
+    void script(uint8_t command, std::vector<Frame> frames, uint32_t delay_us = 0);
+
+    /* answer every command with this code with frames once the script for the
+     * code is used up */
+    void respond(uint8_t command, std::vector<Frame> frames, uint32_t delay_us = 0);
+
+    /* send bytes unprompted, e.g. frames cut at chosen points or line noise;
+     * a burst arrives in one go once its last byte is on the wire, as a late RX
+     * interrupt or a DMA block would hand it over */
+    void send(const Frame &bytes, uint32_t delay_us = 0, bool burst = false);
+
+    /* wait until everything queued has been sent */
+    void flush();
+
+    /* commands received with this code, all codes for 0 */
+    size_t commands(uint8_t command = 0);
+
+    /* payload bytes of the data packets received */
+    size_t data_bytes();
+
+    void received(const uint8_t *data, size_t size) override;
+
+private:
+    struct Reply {
+        std::vector<Frame> frames;
+        uint32_t delay_us;
+    };
+
+    struct Transmission {
+        std::chrono::steady_clock::time_point when;
+        Frame bytes;
+        bool burst;
+    };
+
+    void command(const uint8_t *payload, size_t length);
+    void queue(const std::vector<Frame> &frames, uint32_t delay_us, bool burst = false);
+    void run();
+
+    LineProfile _line;
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::map<uint8_t, std::deque<Reply>> _script;
+    std::map<uint8_t, Reply> _standing;
+    std::deque<Transmission> _pending;
+    bool _sending = false;
+    bool _stopping = false;
+    std::map<uint8_t, size_t> _commands;
+    size_t _command_count = 0;
+    size_t _data_bytes = 0;
+    Frame _input;
+    std::minstd_rand _random;
+    std::thread _thread;
+};
+
+#endif
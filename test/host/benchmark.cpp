@@ -0,0 +1,266 @@
+/* Host benchmark of the sensor link, identification and requests
+ *
+ * Times the driver against the emulated R503 for each line profile and the
+ * HTTP client against the loopback server for each RTT profile. The sensor and
+ * the server answer without processing time, so the figures only move with
+ * the driver, the client and the link timings they are given. Every line is
+ * "name value unit", lower is better; with --baseline FILE (the output of a
+ * previous run) the change of each figure is shown and the run fails when one
+ * got more than --tolerance percent worse.
+ *
+ *   host_benchmark [--iterations N] [--baseline FILE] [--tolerance PERCENT]
+ */
+
+#include "Fingerprint.h"
+#include "LoopbackServer.h"
+#include "Metrics.h"
+#include "R503Emulator.h"
+#include "SocketDemo.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace {
+
+/* baud rate of the UART and timing of the sensor's bytes */
+struct Link {
+    uint32_t baud;
+    LineProfile line;
+};
+
+const Link LINKS[] = {
+    {57600, {"57600", 0, 0}},
+    {115200, {"115200", 0, 0}},
+    // a sensor that pauses between bytes, as seen on a noisy or busy line
+    {115200, {"115200-gaps", 50, 200}},
+};
+
+const RttProfile NETWORKS[] = {
+    {"loopback", 0},
+    {"lan", 2000},
+    {"wan", 40000},
+};
+
+const uint16_t SERVER_PORT = MBED_CONF_APP_USE_TLS_SOCKET ? 443 : 80;
+
+/* payload of the data packets, the most a Fingerprint_Packet carries */
+const uint16_t PACKET_PAYLOAD = 64;
+
+int iterations = 50;
+int errors = 0;
+std::map<std::string, double> results;
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsed_us(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+void report(const std::string &name, double value, const char *unit)
+{
+    results[name] = value;
+    printf("%-36s %12.1f %s\n", name.c_str(), value, unit);
+}
+
+struct Sensor {
+    Sensor(const LineProfile &line, uint32_t baud) : finger(PC_1, PC_0, 0, PB_0), emulator(PC_1, line)
+    {
+        finger.begin(baud);
+    }
+
+    Fingerprint finger;
+    R503Emulator emulator;
+};
+
+/* writeStructuredPacket(): a data packet, the sensor takes it without a reply */
+void bench_write(const LineProfile &line, uint32_t baud, const std::string &prefix)
+{
+    Sensor sensor(line, baud);
+    uint8_t payload[PACKET_PAYLOAD];
+    for (uint16_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i;
+    }
+    Fingerprint_Packet packet(FINGERPRINT_DATAPACKET, sizeof(payload), payload);
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; i++) {
+        sensor.finger.writeStructuredPacket(packet);
+    }
+    double us = elapsed_us(start) / iterations;
+    if (sensor.emulator.data_bytes() != (size_t)iterations * sizeof(payload)) {
+        printf("  %s: the sensor got %u payload bytes\n", prefix.c_str(), (unsigned)sensor.emulator.data_bytes());
+        errors++;
+    }
+    report(prefix + ".write_packet", us, "us/packet");
+}
+
+/* getStructuredPacket(): a stream of data packets, read as they come in */
+void bench_read(const LineProfile &line, uint32_t baud, const std::string &prefix)
+{
+    Sensor sensor(line, baud);
+    std::vector<uint8_t> payload(PACKET_PAYLOAD);
+    for (uint16_t i = 0; i < payload.size(); i++) {
+        payload[i] = i;
+    }
+    R503Emulator::Frame frame = R503Emulator::packet(FINGERPRINT_DATAPACKET, payload);
+    R503Emulator::Frame stream;
+    for (int i = 0; i < iterations; i++) {
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+
+    Fingerprint_Packet packet(FINGERPRINT_DATAPACKET, 0, nullptr);
+    Clock::time_point start = Clock::now();
+    sensor.emulator.send(stream);
+    for (int i = 0; i < iterations; i++) {
+        if (sensor.finger.getStructuredPacket(&packet) != FINGERPRINT_OK || packet.type != FINGERPRINT_DATAPACKET) {
+            printf("  %s: packet %d not received\n", prefix.c_str(), i);
+            errors++;
+            break;
+        }
+    }
+    double us = elapsed_us(start) / iterations;
+    report(prefix + ".read_packet", us, "us/packet");
+}
+
+/* what getFingerprintIDez() runs: identify() and its match */
+void bench_identify(const LineProfile &line, uint32_t baud, bool auto_commands, const std::string &prefix)
+{
+    Sensor sensor(line, baud);
+    sensor.finger.autoCommands = auto_commands;
+    sensor.emulator.respond(FINGERPRINT_AUTOIDENTIFY, {
+        R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x00, 0x00, 0x00, 0x00}),
+        R503Emulator::ack({FINGERPRINT_OK, 0x01, 0x00, 0x00, 0x00, 0x00}),
+        R503Emulator::ack({FINGERPRINT_OK, FINGERPRINT_AUTO_STEP_SEARCH, 0x00, 0x07, 0x00, 0x50}),
+    });
+    sensor.emulator.respond(FINGERPRINT_HISPEEDSEARCH, {R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x07, 0x00, 0x50})});
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (sensor.finger.identify() != FINGERPRINT_OK || sensor.finger.fingerID != 7) {
+            printf("  %s: identification %d failed\n", prefix.c_str(), i);
+            errors++;
+            break;
+        }
+    }
+    double us = elapsed_us(start) / iterations;
+    report(prefix + (auto_commands ? ".identify_auto" : ".identify_capture_search"), us, "us/cycle");
+}
+
+/* apiPOST(): the first request opens the connection, the next ones reuse it */
+void bench_post(const RttProfile &network)
+{
+    std::string prefix = std::string("http.") + network.name;
+    LoopbackServer server(SERVER_PORT, network, [](const LoopbackServer::Request &request) {
+        return LoopbackServer::Response{200, "{\"message\":\"Access granted\",\"allowed\":true}"};
+    });
+    NetworkInterface net;
+    EventQueue queue;
+    SocketDemo sckt(&net, &queue);
+
+    auto post = [&]() {
+        HttpResponse response = sckt.apiPOST("/api/check", [](JsonWriter &json) {
+            json.begin_object()
+                .key("room").string("Bouygues-sb123")
+                .key("footprint").number(7)
+                .end_object();
+        });
+        if (response.status != 200) {
+            printf("  %s: request failed: %d\n", prefix.c_str(), response.status);
+            errors++;
+        }
+    };
+
+    Clock::time_point start = Clock::now();
+    post();
+    report(prefix + ".post_first", elapsed_us(start), "us");
+
+    start = Clock::now();
+    for (int i = 0; i < iterations; i++) {
+        post();
+    }
+    double us = elapsed_us(start) / iterations;
+    report(prefix + ".post", us, "us/request");
+    // what the client adds to the round trip of the request
+    report(prefix + ".post_overhead", us - network.rtt_us, "us/request");
+}
+
+/* "name value unit" lines of a previous run */
+std::map<std::string, double> load(const char *path)
+{
+    std::map<std::string, double> baseline;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("cannot read %s\n", path);
+        exit(2);
+    }
+    char name[128];
+    double value;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%127s %lf", name, &value) == 2) {
+            baseline[name] = value;
+        }
+    }
+    fclose(file);
+    return baseline;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const char *baseline_path = nullptr;
+    double tolerance = 25;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--iterations") == 0) {
+            iterations = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[i + 1]);
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    Metrics::init();
+    for (const Link &link : LINKS) {
+        std::string prefix = std::string("sensor.") + link.line.name;
+        bench_write(link.line, link.baud, prefix);
+        bench_read(link.line, link.baud, prefix);
+        bench_identify(link.line, link.baud, true, prefix);
+        bench_identify(link.line, link.baud, false, prefix);
+    }
+    for (const RttProfile &network : NETWORKS) {
+        bench_post(network);
+    }
+    printf("\n");
+    Metrics::print();
+
+    int regressions = 0;
+    if (baseline_path) {
+        printf("\n%-36s %12s %12s %8s\n", "compared to", "baseline", "now", "change");
+        for (const auto &base : load(baseline_path)) {
+            auto now = results.find(base.first);
+            if (now == results.end() || base.second <= 0) {
+                continue;
+            }
+            double change = (now->second - base.second) * 100 / base.second;
+            bool worse = change > tolerance;
+            regressions += worse;
+            printf("%-36s %12.1f %12.1f %+7.1f%%%s\n", base.first.c_str(), base.second, now->second, change,
+                   worse ? " REGRESSION" : "");
+        }
+    }
+
+    if (errors || regressions) {
+        printf("%d errors, %d regressions\n", errors, regressions);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+/* mbed-trace on a PC
+ *
+ * Warnings and errors go to stderr with their group, debug and info traces are
+ * dropped so that they don't end up in the measured times.
+ */
+
+#ifndef HOST_MBED_TRACE_H
+#define HOST_MBED_TRACE_H
+
+#include <cstdarg>
+#include <cstdio>
+
+inline void mbed_host_trace(const char *level, const char *group, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%s][%s]: ", level, group);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+inline void mbed_host_trace_drop(const char *, ...)
+{
+}
+
+#define tr_debug(...) mbed_host_trace_drop(__VA_ARGS__)
+#define tr_info(...) mbed_host_trace_drop(__VA_ARGS__)
+#define tr_warn(...) mbed_host_trace("WARN", TRACE_GROUP, __VA_ARGS__)
+#define tr_error(...) mbed_host_trace("ERR ", TRACE_GROUP, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,477 @@
+/* mbed-os on a PC
+ *
+ * The part of the mbed-os 6 API used by the sensor driver and the HTTP client,
+ * on top of the C++ standard library, so that they run unchanged in the host
+ * tests and benchmark. Pins only name a line: the UART of a pin is wired to a
+ * mbed_host::SerialDevice (the emulated R503) and the sockets to a
+ * mbed_host::Listener (the loopback server) registered for it. Interrupt
+ * handlers run on the device thread inside the critical section, which is one
+ * recursive mutex for the whole program, so they exclude each other and the
+ * driver's critical sections the way an interrupt does.
+ */
+
+#ifndef HOST_MBED_H
+#define HOST_MBED_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <sys/types.h>
+#include <type_traits>
+#include <utility>
+
+using namespace std::chrono_literals;
+
+typedef enum {
+    PA_0, PA_1, PA_2, PA_3,
+    PB_0, PB_1, PB_2, PB_3,
+    PC_0, PC_1, PC_2, PC_3,
+    PD_4, PD_5, PD_6,
+    NC = -1
+} PinName;
+
+typedef enum { PullNone, PullUp, PullDown, PullDefault = PullNone } PinMode;
+
+typedef int nsapi_error_t;
+typedef int nsapi_size_or_error_t;
+typedef int nsapi_value_or_error_t;
+typedef unsigned nsapi_size_t;
+typedef enum { NSAPI_UNSPEC, NSAPI_IPv4, NSAPI_IPv6 } nsapi_version_t;
+
+enum {
+    NSAPI_ERROR_OK = 0,
+    NSAPI_ERROR_WOULD_BLOCK = -3001,
+    NSAPI_ERROR_UNSUPPORTED = -3002,
+    NSAPI_ERROR_PARAMETER = -3003,
+    NSAPI_ERROR_NO_CONNECTION = -3004,
+    NSAPI_ERROR_NO_SOCKET = -3005,
+    NSAPI_ERROR_NO_ADDRESS = -3006,
+    NSAPI_ERROR_DNS_FAILURE = -3009,
+    NSAPI_ERROR_IS_CONNECTED = -3015,
+    NSAPI_ERROR_CONNECTION_LOST = -3016,
+    NSAPI_ERROR_TIMEOUT = -3019
+};
+
+#define MBED_ASSERT(expr) ((void)(expr))
+#define MBED_UNUSED __attribute__((unused))
+
+extern "C" {
+void core_util_critical_section_enter(void);
+void core_util_critical_section_exit(void);
+/* microseconds since the program started, wraps like the hardware ticker */
+uint32_t us_ticker_read(void);
+}
+
+extern uint32_t SystemCoreClock;
+
+namespace mbed {
+
+template <typename T>
+class Span {
+public:
+    Span() : _data(nullptr), _size(0) {}
+    Span(T *data, ptrdiff_t size) : _data(data), _size(size) {}
+    template <size_t N>
+    Span(T (&array)[N]) : _data(array), _size(N) {}
+
+    T *data() const { return _data; }
+    ptrdiff_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    T &operator[](ptrdiff_t index) const { return _data[index]; }
+    T *begin() const { return _data; }
+    T *end() const { return _data + _size; }
+    Span first(ptrdiff_t count) const { return Span(_data, count); }
+    Span last(ptrdiff_t count) const { return Span(_data + _size - count, count); }
+    Span subspan(ptrdiff_t offset, ptrdiff_t count = -1) const
+    {
+        return Span(_data + offset, count < 0 ? _size - offset : count);
+    }
+
+private:
+    T *_data;
+    ptrdiff_t _size;
+};
+
+template <typename F>
+class Callback;
+
+template <typename R, typename... A>
+class Callback<R(A...)> {
+public:
+    Callback() {}
+    Callback(std::nullptr_t) {}
+    Callback(R (*function)(A...))
+    {
+        if (function) {
+            _function = function;
+        }
+    }
+    template <typename T, typename U>
+    Callback(U *object, R (T::*method)(A...)) :
+        _function([object, method](A... args) { return (object->*method)(args...); })
+    {
+    }
+    template <typename T, typename U>
+    Callback(const U *object, R (T::*method)(A...) const) :
+        _function([object, method](A... args) { return (object->*method)(args...); })
+    {
+    }
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_pointer<F>::value &&
+                              !std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+    Callback(F function) : _function(std::move(function))
+    {
+    }
+
+    R operator()(A... args) const { return _function(args...); }
+    R call(A... args) const { return _function(args...); }
+    explicit operator bool() const { return static_cast<bool>(_function); }
+
+private:
+    std::function<R(A...)> _function;
+};
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*function)(A...))
+{
+    return Callback<R(A...)>(function);
+}
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(U *object, R (T::*method)(A...))
+{
+    return Callback<R(A...)>(object, method);
+}
+
+class UnbufferedSerial;
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin, PinMode mode = PullDefault);
+    int read() { return _level; }
+    operator int() { return read(); }
+    void rise(Callback<void()> handler) { _rise = handler; }
+    void fall(Callback<void()> handler) { _fall = handler; }
+    void mode(PinMode) {}
+
+    /* host side: drive the line, the handler of the edge runs as an interrupt */
+    void drive(int level);
+
+private:
+    int _level = 1;
+    Callback<void()> _rise;
+    Callback<void()> _fall;
+};
+
+} // namespace mbed
+
+namespace mbed_host {
+
+/* The other end of the UART of a pin, e.g. an emulated sensor. It is wired to
+ * the UnbufferedSerial of that TX pin whichever is created first */
+class SerialDevice {
+public:
+    explicit SerialDevice(PinName tx);
+    virtual ~SerialDevice();
+
+    /* bytes the MCU wrote, called on the writer's thread once they are on the line */
+    virtual void received(const uint8_t *data, size_t size) = 0;
+
+    /* rate the MCU side is set to, 0 while no UART is wired */
+    int baud() const;
+
+protected:
+    /* bytes to the MCU, the RX interrupt handler runs from here. Dropped while
+     * the MCU has its input off */
+    void transmit(const uint8_t *data, size_t size);
+
+private:
+    friend class mbed::UnbufferedSerial;
+    PinName _tx;
+    mbed::UnbufferedSerial *_serial = nullptr;
+};
+
+/* sleep until a point of the steady clock, spinning the last stretch: UART byte
+ * times are shorter than the scheduler's slack */
+void wait_until(std::chrono::steady_clock::time_point when);
+
+} // namespace mbed_host
+
+namespace mbed {
+
+class UnbufferedSerial {
+public:
+    enum IrqType { RxIrq = 0, TxIrq };
+
+    UnbufferedSerial(PinName tx, PinName rx, int baud = 9600);
+    ~UnbufferedSerial();
+
+    void baud(int baudrate) { _baud = baudrate; }
+
+    /* blocks for the time the bytes take on the line, as the hardware does */
+    ssize_t write(const void *buffer, size_t size);
+    ssize_t read(void *buffer, size_t size);
+    bool readable();
+    void attach(Callback<void()> handler, IrqType type = RxIrq);
+    int enable_input(bool enabled);
+
+private:
+    friend class mbed_host::SerialDevice;
+    void deliver(const uint8_t *data, size_t size);
+
+    PinName _tx;
+    std::atomic<int> _baud;
+    std::atomic<bool> _input{true};
+    std::deque<uint8_t> _rx; // guarded by the critical section
+    Callback<void()> _rx_handler;
+    mbed_host::SerialDevice *_device = nullptr;
+};
+
+} // namespace mbed
+
+namespace rtos {
+
+namespace Kernel {
+struct Clock {
+    typedef std::chrono::milliseconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<Clock> time_point;
+    static constexpr bool is_steady = true;
+    static time_point now();
+};
+} // namespace Kernel
+
+class Mutex {
+public:
+    Mutex() {}
+    Mutex(const char *) {}
+    void lock() { _mutex.lock(); }
+    bool trylock() { return _mutex.try_lock(); }
+    void unlock() { _mutex.unlock(); }
+
+private:
+    std::recursive_mutex _mutex;
+};
+
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0, uint16_t max_count = 0xFFFF) : _count(count), _max(max_count) {}
+    void acquire();
+    bool try_acquire();
+    bool try_acquire_for(Kernel::Clock::duration timeout);
+    bool try_acquire_until(Kernel::Clock::time_point deadline);
+    int32_t release();
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    int32_t _count;
+    uint16_t _max;
+};
+
+template <typename L>
+class ScopedLock {
+public:
+    ScopedLock(L &lockable) : _lockable(lockable) { _lockable.lock(); }
+    ~ScopedLock() { _lockable.unlock(); }
+    ScopedLock(const ScopedLock &) = delete;
+    ScopedLock &operator=(const ScopedLock &) = delete;
+
+private:
+    L &_lockable;
+};
+
+namespace ThisThread {
+void sleep_for(Kernel::Clock::duration duration);
+void sleep_until(Kernel::Clock::time_point when);
+} // namespace ThisThread
+
+} // namespace rtos
+
+namespace events {
+
+/* events run on the thread calling dispatch_forever(), in time order */
+class EventQueue {
+public:
+    EventQueue(unsigned size = 0, unsigned char *buffer = nullptr) {}
+
+    template <typename F, typename... A>
+    int call(F function, A... args)
+    {
+        return post(0ms, 0ms, [=]() mutable { function(args...); });
+    }
+    template <typename T, typename R, typename... B, typename... A>
+    int call(T *object, R (T::*method)(B...), A... args)
+    {
+        return post(0ms, 0ms, [=]() { (object->*method)(args...); });
+    }
+    template <typename F, typename... A>
+    int call_in(std::chrono::milliseconds delay, F function, A... args)
+    {
+        return post(delay, 0ms, [=]() mutable { function(args...); });
+    }
+    template <typename T, typename R, typename... B, typename... A>
+    int call_in(std::chrono::milliseconds delay, T *object, R (T::*method)(B...), A... args)
+    {
+        return post(delay, 0ms, [=]() { (object->*method)(args...); });
+    }
+    template <typename F, typename... A>
+    int call_every(std::chrono::milliseconds period, F function, A... args)
+    {
+        return post(period, period, [=]() mutable { function(args...); });
+    }
+    template <typename T, typename R, typename... B, typename... A>
+    int call_every(std::chrono::milliseconds period, T *object, R (T::*method)(B...), A... args)
+    {
+        return post(period, period, [=]() { (object->*method)(args...); });
+    }
+
+    bool cancel(int id);
+    void dispatch_forever();
+    void break_dispatch();
+
+private:
+    struct Event {
+        int id;
+        std::chrono::steady_clock::time_point when;
+        std::chrono::milliseconds period;
+        std::function<void()> function;
+    };
+
+    int post(std::chrono::milliseconds delay, std::chrono::milliseconds period,
+             std::function<void()> function);
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<Event> _events;
+    int _next_id = 1;
+    bool _break = false;
+};
+
+} // namespace events
+
+class SocketAddress {
+public:
+    SocketAddress() {}
+    SocketAddress(const char *ip, uint16_t port = 0) : _ip(ip ? ip : ""), _port(port) {}
+    const char *get_ip_address() const { return _ip.empty() ? nullptr : _ip.c_str(); }
+    bool set_ip_address(const char *ip)
+    {
+        _ip = ip ? ip : "";
+        return true;
+    }
+    void set_port(uint16_t port) { _port = port; }
+    uint16_t get_port() const { return _port; }
+    operator bool() const { return !_ip.empty(); }
+
+private:
+    std::string _ip;
+    uint16_t _port = 0;
+};
+
+/* every hostname resolves to the loopback address, where the listeners are */
+class NetworkInterface {
+public:
+    typedef mbed::Callback<void(nsapi_value_or_error_t, SocketAddress *)> hostbyname_cb_t;
+
+    virtual ~NetworkInterface() {}
+    virtual nsapi_error_t gethostbyname(const char *host, SocketAddress *address,
+                                        nsapi_version_t version = NSAPI_UNSPEC,
+                                        const char *interface_name = nullptr);
+    virtual nsapi_value_or_error_t gethostbyname_async(const char *host, hostbyname_cb_t callback,
+                                                       nsapi_version_t version = NSAPI_UNSPEC,
+                                                       const char *interface_name = nullptr)
+    {
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+};
+
+namespace mbed_host {
+
+/* one direction of a connection */
+class Pipe {
+public:
+    nsapi_size_or_error_t write(const void *data, size_t size);
+    /* waits up to timeout_ms (forever if negative) for bytes, 0 once closed and empty */
+    nsapi_size_or_error_t read(void *data, size_t size, int timeout_ms);
+    void close();
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<char> _bytes;
+    bool _closed = false;
+};
+
+struct Connection {
+    Pipe up;   // client to server
+    Pipe down; // server to client
+
+    void close()
+    {
+        up.close();
+        down.close();
+    }
+};
+
+/* accepts the connections made to a port, see listen() */
+class Listener {
+public:
+    virtual ~Listener() {}
+    /* called on the connecting thread, connect() returns what this returns */
+    virtual nsapi_error_t accept(std::shared_ptr<Connection> connection, bool tls) = 0;
+};
+
+/* route the connections to port to listener, nullptr to stop */
+void listen(uint16_t port, Listener *listener);
+
+} // namespace mbed_host
+
+class TCPSocket {
+public:
+    TCPSocket() {}
+    virtual ~TCPSocket() { close(); }
+
+    nsapi_error_t open(NetworkInterface *stack);
+    nsapi_error_t connect(const SocketAddress &address);
+    nsapi_size_or_error_t send(const void *data, nsapi_size_t size);
+    nsapi_size_or_error_t recv(void *data, nsapi_size_t size);
+    void set_timeout(int timeout) { _timeout = timeout; }
+    void set_blocking(bool blocking) { _timeout = blocking ? -1 : 0; }
+    nsapi_error_t close();
+
+protected:
+    bool _tls = false;
+
+private:
+    std::shared_ptr<mbed_host::Connection> _connection;
+    int _timeout = -1;
+};
+
+#include "mbedtls/x509_crt.h"
+
+/* no encryption on loopback, the handshake only costs the listener's round trips */
+class TLSSocket : public TCPSocket {
+public:
+    TLSSocket() { _tls = true; }
+    void set_hostname(const char *) {}
+    void set_ca_chain(mbedtls_x509_crt *) {}
+};
+
+using namespace mbed;
+using namespace rtos;
+using namespace events;
+
+#endif
@@ -0,0 +1,419 @@
+/* mbed-os on a PC
+ */
+
+#include "mbed.h"
+#include <algorithm>
+#include <map>
+#include <thread>
+
+uint32_t SystemCoreClock = 80000000;
+
+namespace {
+
+const std::chrono::steady_clock::time_point START = std::chrono::steady_clock::now();
+
+/* interrupts are masked by taking it, handlers run with it held */
+std::recursive_mutex &critical_section()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+std::chrono::steady_clock::time_point steady(rtos::Kernel::Clock::time_point when)
+{
+    return START + when.time_since_epoch();
+}
+
+/* the UARTs and devices of each TX pin, and the listeners of each port */
+std::mutex registry_mutex;
+std::map<PinName, mbed::UnbufferedSerial *> serials;
+std::map<PinName, mbed_host::SerialDevice *> devices;
+std::map<uint16_t, mbed_host::Listener *> listeners;
+
+}
+
+extern "C" void core_util_critical_section_enter(void)
+{
+    critical_section().lock();
+}
+
+extern "C" void core_util_critical_section_exit(void)
+{
+    critical_section().unlock();
+}
+
+extern "C" uint32_t us_ticker_read(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count();
+}
+
+void mbed_host::wait_until(std::chrono::steady_clock::time_point when)
+{
+    std::chrono::steady_clock::time_point coarse = when - std::chrono::microseconds(200);
+    if (std::chrono::steady_clock::now() < coarse) {
+        std::this_thread::sleep_until(coarse);
+    }
+    while (std::chrono::steady_clock::now() < when) {
+    }
+}
+
+///////////////////////////
+//////    UART    /////////
+///////////////////////////
+
+mbed_host::SerialDevice::SerialDevice(PinName tx) : _tx(tx)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    devices[tx] = this;
+    auto serial = serials.find(tx);
+    if (serial != serials.end()) {
+        _serial = serial->second;
+        _serial->_device = this;
+    }
+}
+
+mbed_host::SerialDevice::~SerialDevice()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    devices.erase(_tx);
+    if (_serial) {
+        _serial->_device = nullptr;
+    }
+}
+
+int mbed_host::SerialDevice::baud() const
+{
+    return _serial ? _serial->_baud.load() : 0;
+}
+
+void mbed_host::SerialDevice::transmit(const uint8_t *data, size_t size)
+{
+    if (_serial) {
+        _serial->deliver(data, size);
+    }
+}
+
+mbed::UnbufferedSerial::UnbufferedSerial(PinName tx, PinName rx, int baud) : _tx(tx), _baud(baud)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    serials[tx] = this;
+    auto device = devices.find(tx);
+    if (device != devices.end()) {
+        _device = device->second;
+        _device->_serial = this;
+    }
+}
+
+mbed::UnbufferedSerial::~UnbufferedSerial()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    serials.erase(_tx);
+    if (_device) {
+        _device->_serial = nullptr;
+    }
+}
+
+ssize_t mbed::UnbufferedSerial::write(const void *buffer, size_t size)
+{
+    // start bit, 8 data bits and a stop bit per byte
+    mbed_host::wait_until(std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(size * 10 * 1000000ull / _baud));
+    if (_device) {
+        _device->received(static_cast<const uint8_t *>(buffer), size);
+    }
+    return size;
+}
+
+ssize_t mbed::UnbufferedSerial::read(void *buffer, size_t size)
+{
+    core_util_critical_section_enter();
+    size_t count = std::min(size, _rx.size());
+    std::copy_n(_rx.begin(), count, static_cast<uint8_t *>(buffer));
+    _rx.erase(_rx.begin(), _rx.begin() + count);
+    core_util_critical_section_exit();
+    return count;
+}
+
+bool mbed::UnbufferedSerial::readable()
+{
+    core_util_critical_section_enter();
+    bool result = !_rx.empty();
+    core_util_critical_section_exit();
+    return result;
+}
+
+void mbed::UnbufferedSerial::attach(Callback<void()> handler, IrqType type)
+{
+    if (type == RxIrq) {
+        core_util_critical_section_enter();
+        _rx_handler = handler;
+        core_util_critical_section_exit();
+    }
+}
+
+int mbed::UnbufferedSerial::enable_input(bool enabled)
+{
+    _input = enabled;
+    return 0;
+}
+
+void mbed::UnbufferedSerial::deliver(const uint8_t *data, size_t size)
+{
+    if (!_input) {
+        return;
+    }
+    core_util_critical_section_enter();
+    _rx.insert(_rx.end(), data, data + size);
+    if (_rx_handler) {
+        _rx_handler();
+    }
+    core_util_critical_section_exit();
+}
+
+mbed::InterruptIn::InterruptIn(PinName pin, PinMode mode)
+{
+}
+
+void mbed::InterruptIn::drive(int level)
+{
+    core_util_critical_section_enter();
+    int previous = _level;
+    _level = level;
+    if (previous && !level && _fall) {
+        _fall();
+    } else if (!previous && level && _rise) {
+        _rise();
+    }
+    core_util_critical_section_exit();
+}
+
+///////////////////////////
+//////    RTOS    /////////
+///////////////////////////
+
+rtos::Kernel::Clock::time_point rtos::Kernel::Clock::now()
+{
+    return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - START));
+}
+
+void rtos::Semaphore::acquire()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _count > 0; });
+    _count--;
+}
+
+bool rtos::Semaphore::try_acquire()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_count == 0) {
+        return false;
+    }
+    _count--;
+    return true;
+}
+
+bool rtos::Semaphore::try_acquire_for(Kernel::Clock::duration timeout)
+{
+    return try_acquire_until(Kernel::Clock::now() + timeout);
+}
+
+bool rtos::Semaphore::try_acquire_until(Kernel::Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_changed.wait_until(lock, steady(deadline), [this] { return _count > 0; })) {
+        return false;
+    }
+    _count--;
+    return true;
+}
+
+int32_t rtos::Semaphore::release()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_count < _max) {
+        _count++;
+    }
+    _changed.notify_one();
+    return 0;
+}
+
+void rtos::ThisThread::sleep_for(Kernel::Clock::duration duration)
+{
+    std::this_thread::sleep_for(duration);
+}
+
+void rtos::ThisThread::sleep_until(Kernel::Clock::time_point when)
+{
+    std::this_thread::sleep_until(steady(when));
+}
+
+int events::EventQueue::post(std::chrono::milliseconds delay, std::chrono::milliseconds period,
+                             std::function<void()> function)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    int id = _next_id++;
+    Event event = {id, std::chrono::steady_clock::now() + delay, period, std::move(function)};
+    auto position = std::upper_bound(_events.begin(), _events.end(), event.when,
+    [](std::chrono::steady_clock::time_point when, const Event &other) {
+        return when < other.when;
+    });
+    _events.insert(position, std::move(event));
+    _changed.notify_all();
+    return id;
+}
+
+bool events::EventQueue::cancel(int id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto event = _events.begin(); event != _events.end(); ++event) {
+        if (event->id == id) {
+            _events.erase(event);
+            return true;
+        }
+    }
+    return false;
+}
+
+void events::EventQueue::dispatch_forever()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _break = false;
+    while (!_break) {
+        if (_events.empty()) {
+            _changed.wait(lock);
+            continue;
+        }
+        if (std::chrono::steady_clock::now() < _events.front().when) {
+            _changed.wait_until(lock, _events.front().when);
+            continue;
+        }
+        Event event = std::move(_events.front());
+        _events.pop_front();
+        lock.unlock();
+        event.function();
+        lock.lock();
+        if (event.period.count() > 0) {
+            event.when += event.period;
+            auto position = std::upper_bound(_events.begin(), _events.end(), event.when,
+            [](std::chrono::steady_clock::time_point when, const Event &other) {
+                return when < other.when;
+            });
+            _events.insert(position, std::move(event));
+        }
+    }
+}
+
+void events::EventQueue::break_dispatch()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _break = true;
+    _changed.notify_all();
+}
+
+///////////////////////////
+//////  NETWORK   /////////
+///////////////////////////
+
+nsapi_error_t NetworkInterface::gethostbyname(const char *host, SocketAddress *address,
+                                              nsapi_version_t version, const char *interface_name)
+{
+    address->set_ip_address("127.0.0.1");
+    return NSAPI_ERROR_OK;
+}
+
+nsapi_size_or_error_t mbed_host::Pipe::write(const void *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed) {
+        return NSAPI_ERROR_CONNECTION_LOST;
+    }
+    const char *bytes = static_cast<const char *>(data);
+    _bytes.insert(_bytes.end(), bytes, bytes + size);
+    _changed.notify_all();
+    return size;
+}
+
+nsapi_size_or_error_t mbed_host::Pipe::read(void *data, size_t size, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto ready = [this] { return !_bytes.empty() || _closed; };
+    if (timeout_ms < 0) {
+        _changed.wait(lock, ready);
+    } else if (!_changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready)) {
+        return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    size_t count = std::min(size, _bytes.size());
+    std::copy_n(_bytes.begin(), count, static_cast<char *>(data));
+    _bytes.erase(_bytes.begin(), _bytes.begin() + count);
+    return count;
+}
+
+void mbed_host::Pipe::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _changed.notify_all();
+}
+
+void mbed_host::listen(uint16_t port, Listener *listener)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (listener) {
+        listeners[port] = listener;
+    } else {
+        listeners.erase(port);
+    }
+}
+
+nsapi_error_t TCPSocket::open(NetworkInterface *stack)
+{
+    return stack ? NSAPI_ERROR_OK : NSAPI_ERROR_PARAMETER;
+}
+
+nsapi_error_t TCPSocket::connect(const SocketAddress &address)
+{
+    if (_connection) {
+        return NSAPI_ERROR_IS_CONNECTED;
+    }
+    mbed_host::Listener *listener;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto found = listeners.find(address.get_port());
+        if (found == listeners.end()) {
+            return NSAPI_ERROR_NO_CONNECTION;
+        }
+        listener = found->second;
+    }
+    std::shared_ptr<mbed_host::Connection> connection = std::make_shared<mbed_host::Connection>();
+    nsapi_error_t result = listener->accept(connection, _tls);
+    if (result == NSAPI_ERROR_OK) {
+        _connection = connection;
+    }
+    return result;
+}
+
+nsapi_size_or_error_t TCPSocket::send(const void *data, nsapi_size_t size)
+{
+    if (!_connection) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+    return _connection->up.write(data, size);
+}
+
+nsapi_size_or_error_t TCPSocket::recv(void *data, nsapi_size_t size)
+{
+    if (!_connection) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+    return _connection->down.read(data, size, _timeout);
+}
+
+nsapi_error_t TCPSocket::close()
+{
+    if (_connection) {
+        _connection->close();
+        _connection.reset();
+    }
+    return NSAPI_ERROR_OK;
+}
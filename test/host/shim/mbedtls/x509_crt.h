@@ -0,0 +1,28 @@
+/* mbedtls certificate chain, there is nothing to verify on loopback */
+
+#ifndef HOST_MBEDTLS_X509_CRT_H
+#define HOST_MBEDTLS_X509_CRT_H
+
+#include <cstddef>
+
+struct mbedtls_x509_crt {
+    int parsed;
+};
+
+inline void mbedtls_x509_crt_init(mbedtls_x509_crt *crt)
+{
+    crt->parsed = 0;
+}
+
+inline int mbedtls_x509_crt_parse(mbedtls_x509_crt *crt, const unsigned char *, size_t)
+{
+    crt->parsed = 1;
+    return 0;
+}
+
+inline void mbedtls_x509_crt_free(mbedtls_x509_crt *crt)
+{
+    crt->parsed = 0;
+}
+
+#endif
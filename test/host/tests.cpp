@@ -0,0 +1,249 @@
+/* Host tests of the sensor driver and the HTTP client
+ *
+ * Each test runs a Fingerprint against a scripted R503Emulator, or a SocketDemo
+ * against a LoopbackServer. Without arguments every test runs, otherwise the
+ * ones named.
+ */
+
+#include "Fingerprint.h"
+#include "LoopbackServer.h"
+#include "R503Emulator.h"
+#include "SocketDemo.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const LineProfile LINE = {"115200", 0, 0};
+const RttProfile LOCAL = {"local", 0};
+const uint16_t SERVER_PORT = MBED_CONF_APP_USE_TLS_SOCKET ? 443 : 80;
+
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+bool check(bool condition, const char *text, const char *file, int line)
+{
+    if (!condition) {
+        printf("  %s:%d: CHECK(%s) failed\n", file, line, text);
+        failures++;
+    }
+    return condition;
+}
+
+/* a driver wired to an emulated sensor, the emulator goes first when it is torn
+ * down so that nothing is sent to a UART that is gone */
+struct Sensor {
+    Sensor(const LineProfile &line = LINE) : finger(PC_1, PC_0, 0, PB_0), emulator(PC_1, line)
+    {
+        finger.begin(115200);
+    }
+
+    Fingerprint finger;
+    R503Emulator emulator;
+};
+
+void test_command_reply()
+{
+    Sensor sensor;
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {R503Emulator::ack({FINGERPRINT_OK, 0x01, 0x2C})});
+
+    CHECK(sensor.finger.getTemplateCount() == FINGERPRINT_OK);
+    CHECK(sensor.finger.templateCount == 300);
+    CHECK(sensor.emulator.commands(FINGERPRINT_TEMPLATECOUNT) == 1);
+}
+
+void test_retry_after_timeout()
+{
+    Sensor sensor;
+    // the first command gets no answer at all
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {});
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x02})});
+
+    CHECK(sensor.finger.getTemplateCount() == FINGERPRINT_OK);
+    CHECK(sensor.finger.templateCount == 2);
+    CHECK(sensor.finger.retryCount() == 1);
+    CHECK(sensor.emulator.commands(FINGERPRINT_TEMPLATECOUNT) == 2);
+}
+
+/* the first send is answered after the retry went out: whichever ack the retry
+ * takes, the other one must not be taken as the reply to the next command */
+void test_late_ack()
+{
+    Sensor sensor;
+    // past the 200 ms the driver waits for a TemplateCount ack
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x05})}, 300000);
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x05})});
+    sensor.emulator.script(FINGERPRINT_TEMPLATECOUNT, {R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x07})});
+
+    CHECK(sensor.finger.getTemplateCount() == FINGERPRINT_OK);
+    CHECK(sensor.finger.templateCount == 5);
+    CHECK(sensor.finger.retryCount() == 1);
+    CHECK(sensor.finger.getTemplateCount() == FINGERPRINT_OK);
+    CHECK(sensor.finger.templateCount == 7);
+    CHECK(sensor.emulator.commands(FINGERPRINT_TEMPLATECOUNT) == 3);
+}
+
+/* replies queued behind each other must come out whole and in order */
+void test_back_to_back_frames()
+{
+    Sensor sensor;
+    R503Emulator::Frame stream = R503Emulator::ack({FINGERPRINT_OK, 0x11});
+    R503Emulator::Frame second = R503Emulator::packet(FINGERPRINT_DATAPACKET, {0x21, 0x22, 0x23});
+    stream.insert(stream.end(), second.begin(), second.end());
+    sensor.emulator.send(stream);
+
+    Fingerprint_Packet packet(FINGERPRINT_ACKPACKET, 0, nullptr);
+    CHECK(sensor.finger.getStructuredPacket(&packet) == FINGERPRINT_OK);
+    CHECK(packet.type == FINGERPRINT_ACKPACKET);
+    CHECK(packet.length == 2 + 2);
+    CHECK(packet.data[0] == FINGERPRINT_OK && packet.data[1] == 0x11);
+    CHECK(sensor.finger.getStructuredPacket(&packet) == FINGERPRINT_OK);
+    CHECK(packet.type == FINGERPRINT_DATAPACKET);
+    CHECK(packet.length == 3 + 2);
+    CHECK(packet.data[0] == 0x21 && packet.data[2] == 0x23);
+}
+
+/* frames handed over in one go go through the decoder in RX blocks, whose
+ * boundaries fall anywhere in a frame */
+void test_frame_across_blocks()
+{
+    Sensor sensor;
+    std::vector<uint8_t> payload(40);
+    for (size_t i = 0; i < payload.size(); i++) {
+        payload[i] = i;
+    }
+    // 12 bytes of ack put the first block boundary in the length field of the
+    // data packet, the next ones in its payload and its checksum
+    R503Emulator::Frame stream = R503Emulator::ack({FINGERPRINT_OK});
+    R503Emulator::Frame data = R503Emulator::packet(FINGERPRINT_DATAPACKET, payload);
+    stream.insert(stream.end(), data.begin(), data.end());
+    R503Emulator::Frame last = R503Emulator::ack({FINGERPRINT_NOFINGER});
+    stream.insert(stream.end(), last.begin(), last.end());
+    sensor.emulator.send(stream, 0, true);
+
+    Fingerprint_Packet packet(FINGERPRINT_ACKPACKET, 0, nullptr);
+    CHECK(sensor.finger.getStructuredPacket(&packet) == FINGERPRINT_OK);
+    CHECK(packet.type == FINGERPRINT_ACKPACKET && packet.data[0] == FINGERPRINT_OK);
+    CHECK(sensor.finger.getStructuredPacket(&packet) == FINGERPRINT_OK);
+    CHECK(packet.type == FINGERPRINT_DATAPACKET);
+    CHECK(packet.length == payload.size() + 2);
+    CHECK(memcmp(packet.data, payload.data(), payload.size()) == 0);
+    CHECK(sensor.finger.getStructuredPacket(&packet) == FINGERPRINT_OK);
+    CHECK(packet.type == FINGERPRINT_ACKPACKET && packet.data[0] == FINGERPRINT_NOFINGER);
+}
+
+void test_identify_auto()
+{
+    Sensor sensor;
+    sensor.emulator.script(FINGERPRINT_AUTOIDENTIFY, {
+        R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x00, 0x00, 0x00, 0x00}),
+        R503Emulator::ack({FINGERPRINT_OK, 0x01, 0x00, 0x00, 0x00, 0x00}),
+        R503Emulator::ack({FINGERPRINT_OK, FINGERPRINT_AUTO_STEP_SEARCH, 0x00, 42, 0x00, 80}),
+    });
+
+    CHECK(sensor.finger.identify() == FINGERPRINT_OK);
+    CHECK(sensor.finger.fingerID == 42);
+    CHECK(sensor.finger.confidence == 80);
+    CHECK(sensor.emulator.commands() == 1);
+}
+
+/* a lost command check ack is retried, the sensor still has auto commands */
+void test_identify_auto_retry()
+{
+    Sensor sensor;
+    sensor.emulator.script(FINGERPRINT_AUTOIDENTIFY, {});
+    sensor.emulator.script(FINGERPRINT_AUTOIDENTIFY, {
+        R503Emulator::ack({FINGERPRINT_OK, 0x00, 0x00, 0x00, 0x00, 0x00}),
+        R503Emulator::ack({FINGERPRINT_OK, FINGERPRINT_AUTO_STEP_SEARCH, 0x00, 42, 0x00, 80}),
+    });
+
+    CHECK(sensor.finger.identify() == FINGERPRINT_OK);
+    CHECK(sensor.finger.fingerID == 42);
+    CHECK(sensor.finger.autoCommands);
+    CHECK(sensor.finger.retryCount() == 1);
+    CHECK(sensor.emulator.commands(FINGERPRINT_AUTOIDENTIFY) == 2);
+}
+
+void test_identify_capture_search()
+{
+    Sensor sensor;
+    sensor.finger.autoCommands = false;
+    sensor.emulator.script(FINGERPRINT_HISPEEDSEARCH, {R503Emulator::ack({FINGERPRINT_OK, 0x01, 0x07, 0x00, 90})});
+
+    CHECK(sensor.finger.identify() == FINGERPRINT_OK);
+    CHECK(sensor.finger.fingerID == 263);
+    CHECK(sensor.finger.confidence == 90);
+    CHECK(sensor.emulator.commands(FINGERPRINT_GETIMAGE) == 1);
+    CHECK(sensor.emulator.commands(FINGERPRINT_IMAGE2TZ) == 1);
+}
+
+void test_post_keep_alive()
+{
+    std::string path;
+    std::string body;
+    LoopbackServer server(SERVER_PORT, LOCAL, [&](const LoopbackServer::Request &request) {
+        path = request.path;
+        body = request.body;
+        return LoopbackServer::Response{200, "{\"message\":\"ok\"}"};
+    });
+    NetworkInterface net;
+    EventQueue queue;
+    SocketDemo sckt(&net, &queue);
+
+    for (int id = 1; id <= 2; id++) {
+        bool ok = false;
+        HttpResponse response = sckt.apiPOST("/api/check", [&](JsonWriter &json) {
+            json.begin_object().key("footprint").number(id).end_object();
+        }, [&](const HttpResponse &reply) {
+            ok = span_equals(json_string(reply.body, "message"), "ok");
+        });
+        CHECK(response.status == 200);
+        CHECK(ok);
+        // the body is only handed out under the client's lock
+        CHECK(response.body.empty());
+    }
+    CHECK(path == "/api/check");
+    CHECK(body == "{\"footprint\":2}");
+    CHECK(server.requests() == 2);
+    CHECK(server.connections() == (MBED_CONF_APP_HTTP_KEEP_ALIVE ? 1u : 2u));
+}
+
+struct Test {
+    const char *name;
+    void (*run)();
+};
+
+const Test TESTS[] = {
+    {"command_reply", test_command_reply},
+    {"retry_after_timeout", test_retry_after_timeout},
+    {"late_ack", test_late_ack},
+    {"back_to_back_frames", test_back_to_back_frames},
+    {"frame_across_blocks", test_frame_across_blocks},
+    {"identify_auto", test_identify_auto},
+    {"identify_auto_retry", test_identify_auto_retry},
+    {"identify_capture_search", test_identify_capture_search},
+    {"post_keep_alive", test_post_keep_alive},
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    int run = 0;
+    for (const Test &test : TESTS) {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++) {
+            selected = selected || strcmp(argv[i], test.name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        int before = failures;
+        test.run();
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", test.name);
+        run++;
+    }
+    printf("%d tests, %d failed checks\n", run, failures);
+    return failures ? 1 : 0;
+}